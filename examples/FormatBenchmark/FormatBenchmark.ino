@@ -0,0 +1,84 @@
+// ============================================================
+// PlatformIO: No special build_flags needed for this example.
+//
+// Arduino IDE: No changes needed.
+// ============================================================
+
+// Measures how many CPU cycles a logged (accepted) message costs in the calling task.
+// Logger.log formats the message once into a scratch buffer. For comparison the old way of
+// formatting is also measured: vsnprintf once to find the size, allocate, and vsnprintf again.
+// Log messages are written to a stream that throws everything away, so only the caller side is measured.
+// Set DEFERRED to true to measure with deferred formatting, where the writer task does the formatting.
+
+#include <Elog.h>
+
+#define BENCH 0
+#define ROUNDS 100
+#define DEFERRED false
+
+class NullStream : public Stream {
+public:
+    size_t write(uint8_t) override { return 1; }
+    size_t write(const uint8_t*, size_t size) override { return size; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+};
+
+NullStream nullStream;
+
+// The way messages were formatted before. Measure, allocate, format again.
+void doublePassFormat(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    uint16_t size = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    char* message = new char[size + 1];
+    va_start(args, format);
+    vsnprintf(message, size + 1, format, args);
+    va_end(args);
+    delete[] message;
+}
+
+void benchmark(const char* text)
+{
+    uint32_t started = ESP.getCycleCount();
+    for (int i = 0; i < ROUNDS; i++) {
+        doublePassFormat("Sensor %d reading %s", i, text);
+    }
+    uint32_t doublePassCycles = (ESP.getCycleCount() - started) / ROUNDS;
+
+    started = ESP.getCycleCount();
+    for (int i = 0; i < ROUNDS; i++) {
+        Logger.log(BENCH, ELOG_LEVEL_INFO, "Sensor %d reading %s", i, text);
+    }
+    uint32_t loggerCycles = (ESP.getCycleCount() - started) / ROUNDS;
+
+    delay(1000); // Let the writer task empty the buffer
+
+    Serial.printf("Line length %3d: double pass format %5u cycles, Logger.log %5u cycles, saved %5d cycles per call\n",
+        strlen(text) + 18, doublePassCycles, loggerCycles, (int)doublePassCycles - (int)loggerCycles);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+
+    Logger.configure(ROUNDS * 2, true); // Room for all messages of one round, so we never wait for the writer task
+    if (DEFERRED) {
+        Logger.enableDeferredFormatting();
+    }
+    Logger.registerSerial(BENCH, ELOG_LEVEL_DEBUG, "bench", nullStream);
+}
+
+void loop()
+{
+    benchmark("ok");
+    benchmark("temperature 21.5C humidity 40%");
+    benchmark("temperature 21.5C humidity 40% pressure 1013hPa wind 3.2m/s direction NW");
+    benchmark("temperature 21.5C humidity 40% pressure 1013hPa wind 3.2m/s direction NW rain 0.0mm uv 3 battery 3.71V rssi -67dBm");
+    Serial.println();
+    delay(5000);
+}
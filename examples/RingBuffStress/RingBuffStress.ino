@@ -0,0 +1,137 @@
+// ============================================================
+// PlatformIO: No special build_flags needed for this example.
+//
+// Arduino IDE: No changes needed.
+// ============================================================
+
+// Stress test of the lock-free ring buffer used by the logger.
+// Several producer tasks on both cores push numbered items as fast as they can while one consumer task pops them.
+// The consumer checks that no item is lost, none is duplicated, and items from each producer arrive in order.
+// Both modes of the buffer are tested: line mode (fixed elements) and byte mode (variable length records).
+
+#include <Elog.h>
+
+#define PRODUCERS 4
+#define ITEMS_PER_PRODUCER 100000
+
+struct Item {
+    uint8_t producer;
+    uint32_t number;
+};
+
+LogRingBuff<Item> lineBuff;
+LogRingBuff<Item> byteBuff;
+LogRingBuff<Item>* buff;
+bool byteMode;
+
+std::atomic<uint8_t> producersDone;
+uint32_t nextNumber[PRODUCERS];
+uint32_t errors;
+
+void producerTask(void* parameter)
+{
+    Item item;
+    item.producer = (uintptr_t)parameter;
+    char body[40];
+
+    for (item.number = 0; item.number < ITEMS_PER_PRODUCER; item.number++) {
+        if (byteMode) {
+            uint16_t length = snprintf(body, sizeof(body), "%u.%u", item.producer, item.number) + item.number % 8; // Vary the record size
+            char* record;
+            while ((record = buff->buffReserveRecord(item, length)) == nullptr) {
+                taskYIELD();
+            }
+            snprintf(record, length + 1, "%-*s", length, body);
+            buff->buffCommitRecord(record);
+        } else {
+            while (!buff->buffPush(item)) {
+                taskYIELD();
+            }
+        }
+    }
+    producersDone++;
+    vTaskDelete(NULL);
+}
+
+void checkItem(const Item& item, const char* body)
+{
+    if (item.producer >= PRODUCERS || item.number != nextNumber[item.producer]) {
+        errors++; // Lost, duplicated or out of order
+    }
+    if (body != nullptr) {
+        char expected[20];
+        snprintf(expected, sizeof(expected), "%u.%u", item.producer, item.number);
+        if (strncmp(body, expected, strlen(expected)) != 0) {
+            errors++; // Body does not belong to the item
+        }
+    }
+    if (item.producer < PRODUCERS) {
+        nextNumber[item.producer] = item.number + 1;
+    }
+}
+
+void runTest(bool testByteMode)
+{
+    byteMode = testByteMode;
+    buff = byteMode ? &byteBuff : &lineBuff;
+    producersDone = 0;
+    errors = 0;
+    memset(nextNumber, 0, sizeof(nextNumber));
+
+    uint32_t started = millis();
+    for (uint32_t i = 0; i < PRODUCERS; i++) {
+        xTaskCreatePinnedToCore(producerTask, "producer", 3000, (void*)i, 1, NULL, i % 2); // Spread over both cores
+    }
+
+    uint32_t received = 0;
+    Item item;
+    const char* body;
+    while (received < PRODUCERS * ITEMS_PER_PRODUCER) {
+        bool popped;
+        if (byteMode) {
+            popped = buff->buffPopRecord(item, body);
+            if (popped) {
+                checkItem(item, body);
+                buff->buffReleaseRecords();
+            }
+        } else {
+            popped = buff->buffPop(item);
+            if (popped) {
+                checkItem(item, nullptr);
+            }
+        }
+        if (popped) {
+            received++;
+        } else {
+            taskYIELD();
+        }
+    }
+
+    while (producersDone < PRODUCERS) {
+        delay(1);
+    }
+    bool leftovers = byteMode ? buff->buffPopRecord(item, body) : buff->buffPop(item);
+    for (uint8_t i = 0; i < PRODUCERS; i++) {
+        if (nextNumber[i] != ITEMS_PER_PRODUCER) {
+            errors++;
+        }
+    }
+
+    Serial.printf("%s mode: %u items in %u ms, errors: %u%s\n", byteMode ? "Byte" : "Line", received, millis() - started, errors,
+        leftovers ? ", unexpected items left in buffer!" : "");
+}
+
+void setup()
+{
+    Serial.begin(115200);
+
+    lineBuff.buffCreate(64);
+    byteBuff.buffCreateBytes(2048);
+}
+
+void loop()
+{
+    runTest(false);
+    runTest(true);
+    delay(5000);
+}
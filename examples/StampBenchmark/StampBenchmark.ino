@@ -0,0 +1,164 @@
+// ============================================================
+// PlatformIO: No special build_flags needed for this example.
+//
+// Arduino IDE: No changes needed.
+// ============================================================
+
+// Checks that the log stamp formatting gives exactly the same text as the sprintf based formatting
+// it replaced, and measures how many CPU cycles each time format costs with both.
+// The sprintf versions are kept here as the reference. Every ELOG_FLAG_TIME_* mode, the log levels
+// and the real time format are compared for many times, from boot to hundreds of years of uptime.
+
+#include <Elog.h>
+
+#define CHECKS 20000
+#define ROUNDS 1000
+
+// The formatting as it was done with sprintf
+void referenceMillis(char* output, uint64_t microseconds, bool shortTimeFormat)
+{
+    uint32_t seconds = microseconds / 1000000;
+    uint32_t milliSeconds = microseconds / 1000 % 1000;
+    uint32_t minutes = seconds / 60;
+    uint32_t hours = minutes / 60;
+    uint32_t days = hours / 24;
+
+    if (shortTimeFormat) {
+        sprintf(output, "%02u:%02u:%02u ", hours % 24, minutes % 60, seconds % 60);
+    } else {
+        sprintf(output, "%03u:%02u:%02u:%02u.%03u ", days, hours % 24, minutes % 60, seconds % 60, milliSeconds);
+    }
+}
+
+void referenceSimple(char* output, uint64_t microseconds)
+{
+    sprintf(output, "%09llu ", (unsigned long long)(microseconds / 1000));
+}
+
+void referenceEpoch(char* output, int64_t epochMicroseconds)
+{
+    time_t seconds = epochMicroseconds / 1000000;
+    struct tm tmstruct;
+    localtime_r(&seconds, &tmstruct);
+    sprintf(output, "%04d-%02d-%02d %02d:%02d:%02d.%03d ", tmstruct.tm_year + 1900, tmstruct.tm_mon + 1, tmstruct.tm_mday,
+        tmstruct.tm_hour, tmstruct.tm_min, tmstruct.tm_sec, (int)(epochMicroseconds % 1000000 / 1000));
+}
+
+void referenceLevel(char* output, uint8_t logLevel)
+{
+    char logLevelRawString[8];
+    Formatting::getLogLevelStringRaw(logLevelRawString, logLevel);
+    sprintf(output, "[%-5s] ", logLevelRawString);
+}
+
+uint64_t randomState = 88172645463325252ULL;
+
+// Times spread over all magnitudes. Small ones are as likely as large ones
+uint64_t randomTime()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState >> (randomState % 64);
+}
+
+uint32_t mismatches = 0;
+
+void compare(const char* what, uint64_t time, const char* expected, const char* actual)
+{
+    if (strcmp(expected, actual) != 0) {
+        if (mismatches++ < 10) {
+            Serial.printf("MISMATCH %s at %llu: expected \"%s\", got \"%s\"\n", what, (unsigned long long)time, expected, actual);
+        }
+    }
+}
+
+void checkGoldenOutput()
+{
+    char expected[LENGTH_OF_TIME];
+    char actual[LENGTH_OF_TIME];
+    const uint64_t edges[] = { 0, 999, 1000, 999999, 1000000, 59999999, 3599999999ULL, 86399999999ULL, 4294967295999ULL,
+        4294967296000ULL, 86400000000ULL * 999, 86400000000ULL * 1000, UINT64_MAX };
+
+    mismatches = 0;
+    for (uint32_t i = 0; i < CHECKS + sizeof(edges) / sizeof(edges[0]); i++) {
+        uint64_t time = i < sizeof(edges) / sizeof(edges[0]) ? edges[i] : randomTime();
+
+        referenceMillis(expected, time, false);
+        Formatting::getTimeMillisString(actual, time, false);
+        compare("ELOG_FLAG_TIME_LONG without real time", time, expected, actual);
+
+        referenceMillis(expected, time, true);
+        Formatting::getTimeMillisString(actual, time, true);
+        compare("ELOG_FLAG_TIME_SHORT", time, expected, actual);
+
+        referenceSimple(expected, time);
+        Formatting::getSimpleTimeString(actual, time);
+        compare("ELOG_FLAG_TIME_SIMPLE", time, expected, actual);
+
+        int64_t epoch = 1000000000000000LL + time % 4000000000000000ULL; // 2001 to 2128
+        referenceEpoch(expected, epoch);
+        Formatting::getTimeEpochString(actual, epoch);
+        compare("ELOG_FLAG_TIME_LONG with real time", epoch, expected, actual);
+    }
+    for (uint8_t logLevel = 0; logLevel < ELOG_NUM_LOG_LEVELS; logLevel++) {
+        referenceLevel(expected, logLevel);
+        Formatting::getLogLevelString(actual, logLevel);
+        compare("log level", logLevel, expected, actual);
+    }
+    Serial.printf("Golden output: %u mismatches in %u times\n", mismatches, CHECKS);
+}
+
+#define MEASURE(cycles, call)                                   \
+    {                                                           \
+        uint32_t started = ESP.getCycleCount();                 \
+        for (int i = 0; i < ROUNDS; i++) {                      \
+            call;                                               \
+        }                                                       \
+        cycles = (ESP.getCycleCount() - started) / ROUNDS;      \
+    }
+
+void benchmark(const char* name, uint32_t referenceCycles, uint32_t cycles)
+{
+    Serial.printf("%-24s sprintf %5u cycles, digit tables %5u cycles\n", name, referenceCycles, cycles);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1); // A time zone with daylight saving time
+    tzset();
+}
+
+void loop()
+{
+    char output[LENGTH_OF_TIME];
+    uint64_t time = 1234567890123ULL; // 14 days
+    int64_t epoch = 1718446371123456LL; // June 15 2024
+    uint32_t referenceCycles, cycles;
+
+    checkGoldenOutput();
+
+    MEASURE(referenceCycles, referenceMillis(output, time + i * 1000, false));
+    MEASURE(cycles, Formatting::getTimeMillisString(output, time + i * 1000, false));
+    benchmark("ddd:HH:MM:SS.mmm", referenceCycles, cycles);
+
+    MEASURE(referenceCycles, referenceMillis(output, time + i * 1000, true));
+    MEASURE(cycles, Formatting::getTimeMillisString(output, time + i * 1000, true));
+    benchmark("HH:MM:SS", referenceCycles, cycles);
+
+    MEASURE(referenceCycles, referenceSimple(output, time + i * 1000));
+    MEASURE(cycles, Formatting::getSimpleTimeString(output, time + i * 1000));
+    benchmark("milliseconds", referenceCycles, cycles);
+
+    MEASURE(referenceCycles, referenceEpoch(output, epoch + i * 1000));
+    MEASURE(cycles, Formatting::getTimeEpochString(output, epoch + i * 1000));
+    benchmark("YYYY-MM-DD HH:MM:SS.mmm", referenceCycles, cycles);
+
+    MEASURE(referenceCycles, referenceLevel(output, i % ELOG_NUM_LOG_LEVELS));
+    MEASURE(cycles, Formatting::getLogLevelString(output, i % ELOG_NUM_LOG_LEVELS));
+    benchmark("[LEVEL]", referenceCycles, cycles);
+
+    Serial.println();
+    delay(5000);
+}
@@ -0,0 +1,75 @@
+// ============================================================
+// PlatformIO: No special build_flags needed for this example.
+//
+// Arduino IDE: No changes needed.
+// ============================================================
+
+// Measures how many log lines per second the writer task can output.
+// A burst of messages is logged as fast as possible to a stream that only counts the lines written,
+// so the sinks cost close to nothing and the writer task itself is measured.
+// The writer task used to output one line per FreeRTOS tick, so this was limited to the tick rate.
+// Now it is woken when messages arrive and outputs everything in the buffer in one batch.
+// The time for a single message to reach the stream is also shown (see ELOG_WRITER_LATENCY_MS).
+
+#include <Elog.h>
+
+#define BENCH 0
+#define LINES 10000
+
+class CountingStream : public Stream {
+public:
+    volatile uint32_t lines = 0;
+    size_t write(uint8_t c) override
+    {
+        if (c == '\n') {
+            lines++;
+        }
+        return 1;
+    }
+    size_t write(const uint8_t* buffer, size_t size) override
+    {
+        for (size_t i = 0; i < size; i++) {
+            write(buffer[i]);
+        }
+        return size;
+    }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+};
+
+CountingStream countingStream;
+
+void setup()
+{
+    Serial.begin(115200);
+
+    Logger.configure(200, true); // Wait if buffer is full, so no message is discarded
+    Logger.registerSerial(BENCH, ELOG_LEVEL_DEBUG, "bench", countingStream);
+}
+
+void loop()
+{
+    uint32_t expected = countingStream.lines + LINES;
+    uint32_t started = millis();
+    for (int i = 0; i < LINES; i++) {
+        Logger.log(BENCH, ELOG_LEVEL_INFO, "Sensor %d reading ok", i);
+    }
+    while (countingStream.lines < expected) {
+        delay(1);
+    }
+    uint32_t elapsed = millis() - started;
+
+    delay(100); // Writer task is idle now
+    uint32_t before = countingStream.lines;
+    uint32_t singleStarted = micros();
+    Logger.log(BENCH, ELOG_LEVEL_INFO, "Single message");
+    while (countingStream.lines == before) {
+        delay(1);
+    }
+    uint32_t latency = micros() - singleStarted;
+
+    Serial.printf("%d lines in %u ms: %u lines/s. Single message output after %u us\n",
+        LINES, elapsed, elapsed > 0 ? LINES * 1000 / elapsed : 0, latency);
+    delay(5000);
+}
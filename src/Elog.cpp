@@ -7,25 +7,100 @@ Elog& Elog::getInstance() /**< Singleton pattern */
 }
 
 /** Start the logger
- * @param logLineCapacity the capacity of the log line buffer (number of log lines)
+ * @param logLineCapacity the capacity of the log line buffer (number of log lines). Rounded up to a power of two
  * @param waitIfBufferFull if true, the logger will wait for space in the buffer. If false, it will discard the log message
+ * @param bufferPerCore if true, each CPU core gets its own part of the buffer, so tasks on different cores never touch the same buffer
  * if this is not called by user, it will be called internally by the first log message with default values
  */
-void Elog::configure(uint16_t logLineCapacity, bool waitIfBufferFull)
+void Elog::configure(uint16_t logLineCapacity, bool waitIfBufferFull, bool bufferPerCore)
+{
+    configure(logLineCapacity, waitIfBufferFull ? ELOG_OVERFLOW_BLOCK : ELOG_OVERFLOW_DROP_NEWEST, bufferPerCore);
+}
+
+/** Start the logger
+ * @param logLineCapacity the capacity of the log line buffer (number of log lines). Rounded up to a power of two
+ * @param overflowPolicy what to do with a log message when the buffer is full (see LogOverflowPolicy)
+ * @param bufferPerCore if true, each CPU core gets its own part of the buffer, so tasks on different cores never touch the same buffer
+ */
+void Elog::configure(uint16_t logLineCapacity, LogOverflowPolicy overflowPolicy, bool bufferPerCore)
 {
     if (logStarted) {
         logInternal(ELOG_LEVEL_ERROR, "Logger already started!");
         return;
     }
 
-    this->waitIfBufferFull = waitIfBufferFull;
-    bufferStats.messagesBuffered = 0;
-    bufferStats.messagesDiscarded = 0;
+    ringBuffCount = bufferPerCore ? LOG_BUFFER_CORES : 1;
+    for (uint8_t i = 0; i < ringBuffCount; i++) {
+        if (!ringBuffs[i].buffCreate((logLineCapacity + ringBuffCount - 1) / ringBuffCount)) { //  Create ring buffer for log lines
+            panic("Failed to create log buffer! Not enough heap memory!");
+            return;
+        }
+    }
+    const uint16_t slabBlocks[SLAB_CLASSES] = { ELOG_SLAB_BLOCKS_64, ELOG_SLAB_BLOCKS_128, ELOG_SLAB_BLOCKS_256, ELOG_SLAB_BLOCKS_512 };
+    messageSlab.slabConfigure(slabBlocks); // Memory for messages too long to be stored in the log line entry
+    writerWatermark = min((size_t)ELOG_WRITER_WATERMARK, max(bufferCapacity() / 4, (size_t)1)); // Wake the writer before the buffer gets full
+    start(overflowPolicy);
+
+    logInternal(ELOG_LEVEL_NOTICE, "Logger started with buffer capacity: %d messages", bufferCapacity());
+}
+
+/** Start the logger with a byte budgeted buffer. All log messages are stored inline in one preallocated arena,
+ * so logging never allocates heap memory after this call. How many lines fit depends on their length
+ * @param logBufferBytes the size of the log buffer in bytes
+ * @param waitIfBufferFull if true, the logger will wait for space in the buffer. If false, it will discard the log message
+ * @param bufferPerCore if true, each CPU core gets its own part of the buffer, so tasks on different cores never touch the same buffer
+ */
+void Elog::configureBytes(uint32_t logBufferBytes, bool waitIfBufferFull, bool bufferPerCore)
+{
+    configureBytes(logBufferBytes, waitIfBufferFull ? ELOG_OVERFLOW_BLOCK : ELOG_OVERFLOW_DROP_NEWEST, bufferPerCore);
+}
+
+/** Start the logger with a byte budgeted buffer
+ * @param logBufferBytes the size of the log buffer in bytes
+ * @param overflowPolicy what to do with a log message when the buffer is full (see LogOverflowPolicy).
+ * ELOG_OVERFLOW_DROP_OLDEST is not possible, as only the writer task can take messages from a byte budgeted buffer.
+ * ELOG_OVERFLOW_DROP_NEWEST is used instead
+ * @param bufferPerCore if true, each CPU core gets its own part of the buffer, so tasks on different cores never touch the same buffer
+ */
+void Elog::configureBytes(uint32_t logBufferBytes, LogOverflowPolicy overflowPolicy, bool bufferPerCore)
+{
+    if (logStarted) {
+        logInternal(ELOG_LEVEL_ERROR, "Logger already started!");
+        return;
+    }
+
+    ringBuffCount = bufferPerCore ? LOG_BUFFER_CORES : 1;
+    for (uint8_t i = 0; i < ringBuffCount; i++) {
+        if (!ringBuffs[i].buffCreateBytes(logBufferBytes / ringBuffCount)) { //  Create ring buffer arena for log records
+            panic("Failed to create log buffer! Not enough heap memory!");
+            return;
+        }
+    }
+    writerWatermark = min((uint32_t)ELOG_WRITER_WATERMARK, max(logBufferBytes / 256, (uint32_t)1)); // A quarter of the buffer with 64 byte lines
+    start(overflowPolicy == ELOG_OVERFLOW_DROP_OLDEST ? ELOG_OVERFLOW_DROP_NEWEST : overflowPolicy);
+
+    logInternal(ELOG_LEVEL_NOTICE, "Logger started with buffer capacity: %d bytes", logBufferBytes);
+    if (overflowPolicy == ELOG_OVERFLOW_DROP_OLDEST) {
+        logInternal(ELOG_LEVEL_WARNING, "Drop oldest is not possible with a byte budgeted buffer. Dropping newest instead");
+    }
+}
 
-    if (!ringBuff.buffCreate(logLineCapacity)) { //  Create ring buffer for log lines
-        panic("Failed to create log buffer! Not enough heap memory!");
+/** Common part of configure and configureBytes. The ring buffer must be created before calling this
+ * @param overflowPolicy what to do with a log message when the buffer is full
+ */
+void Elog::start(LogOverflowPolicy overflowPolicy)
+{
+    this->overflowPolicy = overflowPolicy;
+    spaceFreed = xSemaphoreCreateCounting(WAITING_TASKS_MAX, 0);
+    if (spaceFreed == NULL) {
+        panic("Failed to create log buffer semaphore! Not enough heap memory!");
         return;
     }
+    bufferStats.messagesBuffered = 0;
+    bufferStats.messagesDiscarded = 0;
+    for (uint8_t i = 0; i < ELOG_NUM_LOG_LEVELS; i++) {
+        bufferStats.discardedPerLevel[i] = 0;
+    }
 
     logSerial.begin();
     logSD.begin();
@@ -33,8 +108,6 @@ void Elog::configure(uint16_t logLineCapacity, bool waitIfBufferFull)
 
     logStarted = true;
     writerTaskStart(); /**< background task to write logs to the output devices */
-
-    logInternal(ELOG_LEVEL_NOTICE, "Logger started with buffer capacity: %d messages", logLineCapacity);
 }
 
 /** Log a message
@@ -43,83 +116,257 @@ void Elog::configure(uint16_t logLineCapacity, bool waitIfBufferFull)
  * @param format the format of the log message (like printf)
  */
 void Elog::log(uint8_t logId, uint8_t logLevel, const char* format, ...)
+{
+    if (logAccepted(logId, logLevel)) {
+        va_list args;
+        va_start(args, format); /**< initialize the list */
+        if (deferredFormatting) {
+            logDeferred(logId, logLevel, format, args);
+        } else {
+            logv(logId, logLevel, format, args);
+        }
+        va_end(args); /**< end the list */
+    }
+}
+
+void Elog::log(uint8_t logId, uint8_t logLevel, const __FlashStringHelper* format, ...)
+{
+    const char* p = (const char*)format;
+
+    if (logAccepted(logId, logLevel)) {
+        va_list args;
+        va_start(args, format); /**< initialize the list */
+        if (deferredFormatting) {
+            logDeferred(logId, logLevel, p, args);
+        } else {
+            logv(logId, logLevel, p, args);
+        }
+        va_end(args); /**< end the list */
+    }
+}
+
+/** Common checks before a message is logged. Starts the logger if needed and validates the log level
+ * @param logId the id of the log
+ * @param logLevel the level of the log
+ * @return true if the message must be logged
+ */
+bool Elog::logAccepted(uint8_t logId, uint8_t logLevel)
 {
     if (!logStarted) {
         Logger.configure();
     }
     if (logLevel > ELOG_LEVEL_VERBOSE) {
         Logger.logInternal(ELOG_LEVEL_ERROR, "Invalid logLevel! VERBOSE, TRACE, DEBUG, INFO, NOTICE, WARNING, ERROR, CRITICAL, ALERT, EMERGENCY, ALWAYS are the valid levels!");
-        return;
+        return false;
     }
+    return logLevel <= ELOG_MIN_LEVEL && mustLog(logId, logLevel) && !sampledOut(logId, logLevel) && !rateLimited(logId);
+}
 
-    if (mustLog(logId, logLevel)) {
-        va_list args; /**< First find size of the log message */
-        va_start(args, format); /**< initialize the list */
-        uint16_t logLineSize = vsnprintf(NULL, 0, format, args); /**< check the size of the log message */
-        va_end(args); /**< end the list */
+/** Decide if a message is dropped by sampling (see setSampling)
+ * @param logId the id of the log
+ * @param logLevel the level of the log
+ * @return true if the message must not be logged
+ */
+bool Elog::sampledOut(uint8_t logId, uint8_t logLevel)
+{
+    if ((samplingLogIds[logId / 32].load(std::memory_order_relaxed) & (1UL << (logId % 32))) == 0) {
+        return false;
+    }
+
+    uint8_t count = samplingCount.load();
+    for (uint8_t i = 0; i < count; i++) {
+        Sampling& sampling = samplings[i];
+        if (sampling.logId == logId && sampling.logLevel == logLevel) {
+            uint32_t mode = sampling.mode.load(std::memory_order_relaxed);
+            uint32_t keepOneIn = mode & SAMPLING_KEEP_MASK;
+            bool keep;
+            if (mode & SAMPLING_RANDOM) {
+                keep = esp_random() % keepOneIn == 0;
+            } else {
+                keep = sampling.seen.fetch_add(1, std::memory_order_relaxed) % keepOneIn == 0;
+            }
+            if (!keep) {
+                sampling.sampledOut.fetch_add(1, std::memory_order_relaxed);
+            }
+            return !keep;
+        }
+    }
+    return false;
+}
 
-        char* logLineMessage;
-        try {
-            logLineMessage = new char[logLineSize + 1]; /**< reserve memory for the log message + null terminator */
-        } catch (const std::bad_alloc& e) {
-            panic("Failed to allocate heap memory for log message! Not logged!");
-            return;
+/** Format the number of messages sampled out for each sampling, like "3/DEBUG:4950"
+ * @param output the string to write to
+ * @param outputSize the size of output
+ */
+void Elog::formatSampledOut(char* output, size_t outputSize)
+{
+    char logLevelStr[10];
+    size_t used = 0;
+
+    output[0] = 0;
+    for (uint8_t i = 0; i < samplingCount.load() && used < outputSize; i++) {
+        formatter.getLogLevelStringRaw(logLevelStr, samplings[i].logLevel);
+        used += snprintf(output + used, outputSize - used, "%s%d/%s:%u", used > 0 ? " " : "", samplings[i].logId, logLevelStr, samplings[i].sampledOut.load());
+    }
+}
+
+/** Take a message from the token bucket of a log id (see setRateLimit)
+ * @param logId the id of the log
+ * @return true if the bucket is empty. The message must be suppressed
+ */
+bool Elog::rateLimited(uint8_t logId)
+{
+    uint8_t index = rateLimitIndex[logId];
+    if (index == 0) {
+        return false;
+    }
+
+    RateLimit& rateLimit = rateLimits[index - 1];
+    bool limited = false;
+    portENTER_CRITICAL(&rateLimitLock);
+    if (rateLimit.messagesPerSecond != 0) {
+        uint32_t now = millis(); // Read under the lock, so lastRefill is never later than now
+        uint32_t fillTime = (uint32_t)rateLimit.burst * 1000 / rateLimit.messagesPerSecond; // Milliseconds to fill an empty bucket
+        uint32_t elapsed = min(now - rateLimit.lastRefill, fillTime); // Unsigned, so also right when millis() wraps
+        uint32_t tokens = rateLimit.tokens + elapsed * rateLimit.messagesPerSecond; // 1 per second is 1 thousandth per ms
+        rateLimit.tokens = min(tokens, (uint32_t)rateLimit.burst * 1000);
+        rateLimit.lastRefill = now;
+        if (rateLimit.tokens >= 1000) {
+            rateLimit.tokens -= 1000;
+        } else {
+            rateLimit.suppressed++;
+            rateLimit.suppressedTotal++;
+            limited = true;
         }
+    }
+    portEXIT_CRITICAL(&rateLimitLock);
+    return limited;
+}
 
-        va_start(args, format);
-        vsnprintf(logLineMessage, logLineSize + 1, format, args); /**< format the log message */
-        va_end(args); /**< end the list */
+/** Log the number of messages suppressed by rate limits since the last notice. Called regularly by the writer task
+ * The notice is a warning of the log id that was limited. It is not limited itself
+ */
+void Elog::rateLimitNotice()
+{
+    if (rateLimitCount == 0 || millis() - rateLimitNoticed < ELOG_RATE_LIMIT_NOTICE_MS) {
+        return;
+    }
+    rateLimitNoticed = millis();
 
-        LogLineEntry logLineEntry;
-        logLineEntry.timestamp = millis();
-        logLineEntry.logId = logId;
-        logLineEntry.logLevel = logLevel;
-        logLineEntry.internalLogDevice = nullptr;
-        logLineEntry.logMessage = logLineMessage;
+    for (uint8_t i = 0; i < rateLimitCount; i++) {
+        portENTER_CRITICAL(&rateLimitLock);
+        uint32_t suppressed = rateLimits[i].suppressed;
+        rateLimits[i].suppressed = 0;
+        portEXIT_CRITICAL(&rateLimitLock);
 
-        buffAddLogLine(logLineEntry);
+        if (suppressed > 0) {
+            char notice[50];
+            int length = snprintf(notice, sizeof(notice), "Rate limit suppressed %u messages", suppressed);
+            logText(rateLimits[i].logId, ELOG_LEVEL_WARNING, notice, length);
+        }
     }
 }
 
-void Elog::log(uint8_t logId, uint8_t logLevel, const __FlashStringHelper* format, ...)
+/** Format a log message and add it to the buffer
+ * The message is formatted once into a scratch buffer on the stack of the caller and then copied to the log buffer.
+ * Only if it is longer than ELOG_SCRATCH_SIZE it is measured and formatted again directly into the log buffer
+ * @param logId the id of the log
+ * @param logLevel the level of the log
+ * @param format the format of the log message (like printf)
+ * @param args the arguments for the format
+ */
+void Elog::logv(uint8_t logId, uint8_t logLevel, const char* format, va_list args)
 {
-    const char* p = (const char*)format;
+    char scratch[ELOG_SCRATCH_SIZE];
 
-    if (!logStarted) {
-        Logger.configure();
+    va_list argsCopy; /**< args may be needed again if the message does not fit in the scratch buffer */
+    va_copy(argsCopy, args);
+    int formattedSize = vsnprintf(scratch, sizeof(scratch), format, argsCopy); /**< format the log message */
+    va_end(argsCopy);
+    if (formattedSize < 0) {
+        return;
     }
-    if (logLevel > ELOG_LEVEL_VERBOSE) {
-        Logger.logInternal(ELOG_LEVEL_ERROR, "Invalid logLevel! VERBOSE, TRACE, DEBUG, INFO, NOTICE, WARNING, ERROR, CRITICAL, ALERT, EMERGENCY, ALWAYS are the valid levels!");
+    if (dedupWindow != 0) {
+        uint32_t hash;
+        if (formattedSize < (int)sizeof(scratch)) {
+            hash = dedupHash(scratch, formattedSize, formattedSize);
+        } else { // Only the start of an oversized message is in scratch. Hash the format and all arguments instead
+            hash = LOG_HASH_BASIS ^ (uintptr_t)format;
+            va_copy(argsCopy, args);
+            LogArgs::encode(nullptr, 0, format, argsCopy, &hash);
+            va_end(argsCopy);
+        }
+        if (logIsRepeated(logId, logLevel, hash)) {
+            return;
+        }
+    }
+
+    LogLineEntry logLineEntry;
+    logLineEntry.timestamp = esp_timer_get_time();
+    logLineEntry.logId = logId;
+    logLineEntry.logLevel = logLevel;
+    logLineEntry.flags = 0;
+    logLineEntry.logMessage = nullptr;
+    logLineEntry.format = nullptr;
+
+    uint16_t logLineSize = formattedSize > UINT16_MAX ? UINT16_MAX : formattedSize;
+    char* logLineMessage = reserveLogLine(logLineEntry, logLineSize); /**< reserve memory for the log message + null terminator */
+    if (logLineMessage == nullptr) {
         return;
     }
 
-    if (mustLog(logId, logLevel)) {
-        va_list args; /**< First find size of the log message */
-        va_start(args, format); /**< initialize the list */
-        uint16_t logLineSize = vsnprintf_P(NULL, 0, p, args); /**< check the size of the log message */
-        va_end(args); /**< end the list */
+    if (formattedSize < (int)sizeof(scratch)) {
+        memcpy(logLineMessage, scratch, logLineSize);
+        logLineMessage[logLineSize] = '\0';
+    } else {
+        vsnprintf(logLineMessage, logLineSize + 1, format, args); /**< oversized line. format it again into its final place */
+    }
 
-        char* logLineMessage;
-        try {
-            logLineMessage = new char[logLineSize + 1]; /**< reserve memory for the log message + null terminator */
-        } catch (const std::bad_alloc& e) {
-            panic("Failed to allocate heap memory for log message! Not logged!");
-            return;
-        }
+    commitLogLine(logLineEntry, logLineMessage);
+}
 
-        va_start(args, format);
-        vsnprintf(logLineMessage, logLineSize + 1, p, args); /**< format the log message */
-        va_end(args); /**< end the list */
+/** Add a log message to the buffer without formatting it. Only the format pointer and the arguments encoded
+ * by LogArgs are stored. The writer task renders the message later, so the time spent here does not depend
+ * on how complex the format is
+ * @param logId the id of the log
+ * @param logLevel the level of the log
+ * @param format the format of the log message (like printf). Must stay valid until the message is written
+ * @param args the arguments for the format
+ */
+void Elog::logDeferred(uint8_t logId, uint8_t logLevel, const char* format, va_list args)
+{
+    uint8_t scratch[ELOG_SCRATCH_SIZE];
+
+    uint32_t hash = LOG_HASH_BASIS ^ (uintptr_t)format; /**< all arguments are hashed while encoding, also those that do not fit the scratch buffer */
+    va_list argsCopy; /**< args may be needed again if the arguments do not fit in the scratch buffer */
+    va_copy(argsCopy, args);
+    size_t encodedSize = LogArgs::encode(scratch, sizeof(scratch), format, argsCopy, dedupWindow != 0 ? &hash : nullptr);
+    va_end(argsCopy);
+    if (dedupWindow != 0 && logIsRepeated(logId, logLevel, hash)) {
+        return;
+    }
 
-        LogLineEntry logLineEntry;
-        logLineEntry.timestamp = millis();
-        logLineEntry.logId = logId;
-        logLineEntry.logLevel = logLevel;
-        logLineEntry.internalLogDevice = nullptr;
-        logLineEntry.logMessage = logLineMessage;
+    LogLineEntry logLineEntry;
+    logLineEntry.timestamp = esp_timer_get_time();
+    logLineEntry.logId = logId;
+    logLineEntry.logLevel = logLevel;
+    logLineEntry.flags = 0;
+    logLineEntry.logMessage = nullptr;
+    logLineEntry.format = format;
 
-        buffAddLogLine(logLineEntry);
+    uint16_t logLineSize = encodedSize > UINT16_MAX ? UINT16_MAX : encodedSize;
+    char* logLineMessage = reserveLogLine(logLineEntry, logLineSize); /**< reserve memory for the encoded arguments */
+    if (logLineMessage == nullptr) {
+        return;
+    }
+
+    if (encodedSize <= sizeof(scratch) && encodedSize == logLineSize) {
+        memcpy(logLineMessage, scratch, encodedSize);
+    } else {
+        LogArgs::encode((uint8_t*)logLineMessage, logLineSize, format, args); /**< long strings. encode again into its final place */
     }
+
+    commitLogLine(logLineEntry, logLineMessage);
 }
 
 /** Log a message with hex data
@@ -131,38 +378,170 @@ void Elog::log(uint8_t logId, uint8_t logLevel, const __FlashStringHelper* forma
  */
 void Elog::logHex(uint8_t logId, uint8_t logLevel, const char* message, const uint8_t* data, uint16_t length)
 {
-    if (!logStarted) {
-        configure();
+    if (!logAccepted(logId, logLevel)) {
+        return;
     }
-    if (logLevel > ELOG_LEVEL_VERBOSE) {
-        Logger.logInternal(ELOG_LEVEL_ERROR, "Invalid logLevel! VERBOSE, TRACE, DEBUG, INFO, NOTICE, WARNING, ERROR, CRITICAL, ALERT, EMERGENCY, ALWAYS are the valid levels!");
+
+    LogLineEntry logLineEntry;
+    logLineEntry.timestamp = esp_timer_get_time();
+    logLineEntry.logId = logId;
+    logLineEntry.logLevel = logLevel;
+    logLineEntry.flags = 0;
+    logLineEntry.logMessage = nullptr;
+    logLineEntry.format = nullptr;
+
+    size_t messageLength = strlen(message);
+    size_t fullSize = messageLength + 1 + (length > 0 ? length * 3 - 1 : 0); // +1 for space
+    uint16_t logLineSize = fullSize > UINT16_MAX ? UINT16_MAX : fullSize;
+    char* logLineMessage = reserveLogLine(logLineEntry, logLineSize); // may reduce logLineSize
+    if (logLineMessage == nullptr) {
+        return;
+    }
+
+    // The hex data is encoded directly into the log message. Bytes that do not fit are left out
+    size_t position = min(messageLength, (size_t)logLineSize);
+    memcpy(logLineMessage, message, position);
+    if (position < logLineSize) {
+        logLineMessage[position++] = ' ';
+    }
+    uint16_t hexBytes = min((size_t)length, (logLineSize - position + 1) / 3);
+    formatter.getHexString(logLineMessage + position, data, hexBytes);
+    logLineMessage[position + (hexBytes > 0 ? hexBytes * 3 - 1 : 0)] = '\0';
+    commitLogLine(logLineEntry, logLineMessage);
+}
+
+/** Log data as a hexdump. A line with the message and the length is logged, followed by a line for each
+ * HEXDUMP_BYTES_PER_LINE bytes with the offset, the bytes in hex and the bytes as ASCII:
+ * 0000: 48 65 6C 6C 6F 2C 20 77 6F 72 6C 64 00 01 02 03  Hello, world....
+ * Each line is a log message of its own, so large data uses little stack and each line fits the log buffer
+ * @param logId the id of the log (must first be registered with registerSerial, registerSd or registerSpiffs)
+ * @param logLevel the level of the log (VERBOSE, TRACE, DEBUG, INFO, NOTICE, WARNING, ERROR, CRITICAL, ALERT, EMERGENCY, ALWAYS)
+ * @param message a message to log before the hexdump
+ * @param data the data to log (should be typecasted to uint8_t*)
+ * @param length the length of the data
+ */
+void Elog::logHexDump(uint8_t logId, uint8_t logLevel, const char* message, const uint8_t* data, uint16_t length)
+{
+    if (!logAccepted(logId, logLevel)) {
         return;
     }
 
-    char hexData[length * 3 + 1]; /**< +1 for null terminator */
-    for (uint16_t i = 0; i < length; i++) {
-        sprintf(hexData + i * 3, "%02X:", data[i]);
+    char line[LENGTH_OF_HEXDUMP_LINE + 1];
+    snprintf(line, sizeof(line), "%s (%u bytes)", message, length);
+    logText(logId, logLevel, line, strlen(line));
+
+    for (uint32_t offset = 0; offset < length; offset += HEXDUMP_BYTES_PER_LINE) {
+        uint8_t lineBytes = min((uint32_t)HEXDUMP_BYTES_PER_LINE, length - offset);
+        uint16_t lineLength = formatter.getHexDumpLine(line, offset, data + offset, lineBytes);
+        logText(logId, logLevel, line, lineLength);
     }
-    hexData[length * 3 - 1] = '\0'; /**< replace the last ':' with null terminator */
+}
+
+/** Check if a message is a repeat of the last message of its log id (see enableDedup)
+ * When it is not, the summary of the repeats of the last message is logged first
+ * @param logId the id of the log
+ * @param logLevel the level of the log
+ * @param hash the hash of the message (see dedupHash)
+ * @return true if the message is a repeat and must not be logged
+ */
+bool Elog::logIsRepeated(uint8_t logId, uint8_t logLevel, uint32_t hash)
+{
+    DedupSlot& slot = dedupSlots[logId % ELOG_DEDUP_SLOTS];
+    uint32_t now = millis();
+
+    portENTER_CRITICAL(&dedupLock);
+    if (slot.used && slot.logId == logId && slot.logLevel == logLevel && slot.hash == hash && now - slot.windowStarted < dedupWindow) {
+        slot.repeats++;
+        portEXIT_CRITICAL(&dedupLock);
+        return true;
+    }
+    DedupSlot last = slot;
+    slot.used = true;
+    slot.logId = logId;
+    slot.logLevel = logLevel;
+    slot.hash = hash;
+    slot.windowStarted = now;
+    slot.repeats = 0;
+    portEXIT_CRITICAL(&dedupLock);
+
+    if (last.used && last.repeats > 0) {
+        logRepeatSummary(last.logId, last.logLevel, last.repeats);
+    }
+    return false;
+}
 
-    char* logLineMessage;
-    try {
-        logLineMessage = new char[strlen(message) + strlen(hexData) + 2]; // +2 for space and null terminator */
-    } catch (const std::bad_alloc& e) {
-        panic("Failed to allocate heap memory for loghex message! Not logged!");
+/** Log the summary line of a suppressed message
+ * @param logId the id of the log
+ * @param logLevel the level of the repeated message
+ * @param repeats the number of times the message was suppressed
+ */
+void Elog::logRepeatSummary(uint8_t logId, uint8_t logLevel, uint32_t repeats)
+{
+    char summary[50];
+    int length = snprintf(summary, sizeof(summary), "Last message repeated %u times", repeats);
+    logText(logId, logLevel, summary, length);
+}
+
+/** Log the summary of messages whose window has passed without another message for their log id
+ * Called regularly by the writer task
+ */
+void Elog::dedupFlush()
+{
+    if (dedupWindow == 0) {
         return;
     }
+    uint32_t now = millis();
+    for (uint8_t i = 0; i < ELOG_DEDUP_SLOTS; i++) {
+        DedupSlot& slot = dedupSlots[i];
+        portENTER_CRITICAL(&dedupLock);
+        DedupSlot last = slot;
+        bool expired = slot.used && now - slot.windowStarted >= dedupWindow;
+        if (expired) {
+            slot.used = false; // The next message is logged, even if it is the same
+        }
+        portEXIT_CRITICAL(&dedupLock);
 
-    sprintf(logLineMessage, "%s %s", message, hexData);
+        if (expired && last.repeats > 0) {
+            logRepeatSummary(last.logId, last.logLevel, last.repeats);
+        }
+    }
+}
 
+/** Returns a FNV-1a hash of a message. Used to recognize repeated messages
+ * Messages that are not formatted, or are too long to be formatted on the stack, are hashed by their format and
+ * arguments instead (see LogArgs::hashValues)
+ * @param data the formatted message
+ * @param length the length of data
+ * @param seed mixed into the hash, like the length of the message
+ */
+uint32_t Elog::dedupHash(const void* data, size_t length, uint32_t seed)
+{
+    return LogArgs::hashBytes(LOG_HASH_BASIS ^ seed, data, length);
+}
+
+/** Add an already formatted text to the buffer as a log message
+ * @param logId the id of the log
+ * @param logLevel the level of the log
+ * @param text the text of the log message
+ * @param length the length of the text
+ */
+void Elog::logText(uint8_t logId, uint8_t logLevel, const char* text, uint16_t length)
+{
     LogLineEntry logLineEntry;
-    logLineEntry.timestamp = millis();
+    logLineEntry.timestamp = esp_timer_get_time();
     logLineEntry.logId = logId;
     logLineEntry.logLevel = logLevel;
-    logLineEntry.internalLogDevice = nullptr;
-    logLineEntry.logMessage = logLineMessage;
+    logLineEntry.flags = 0;
+    logLineEntry.logMessage = nullptr;
+    logLineEntry.format = nullptr;
 
-    buffAddLogLine(logLineEntry);
+    char* logLineMessage = reserveLogLine(logLineEntry, length); // may reduce length
+    if (logLineMessage == nullptr) {
+        return;
+    }
+    memcpy(logLineMessage, text, length);
+    logLineMessage[length] = '\0';
+    commitLogLine(logLineEntry, logLineMessage);
 }
 
 /** Configure the serial port for logging. If this is not called by the user a default configuration of 10 will be used
@@ -193,6 +572,10 @@ void Elog::registerSerial(const uint8_t logId, const uint8_t logLevel, const cha
         return;
     }
     logSerial.registerSerial(logId, logLevel, serviceName, serial, logFlags);
+    if (logFlags & ELOG_FLAG_SEQUENCE) {
+        sequenceNumbers = true;
+    }
+    updateLogLevelLimits();
 }
 
 uint8_t Elog::getSerialLogLevel(const uint8_t logId, Stream& serial)
@@ -213,6 +596,24 @@ void Elog::setSerialLogLevel(const uint8_t logId, const uint8_t logLevel, Stream
         return;
     }
     logSerial.setLogLevel(logId, logLevel, serial);
+    updateLogLevelLimits();
+}
+
+/** Stamp the log lines of a registration with a pattern instead of its log flags, like "%T %-5L %S: %m".
+ * The pattern is parsed once here. See Formatting::compileLogPattern for the fields.
+ * A registration can get a pattern only once. Later calls are refused, as the writer task may still be using the pattern
+ * @param logId the id of the log
+ * @param pattern the log pattern
+ * @param serial the serial port of the registration. Default is "Serial"
+ */
+void Elog::setSerialLogPattern(const uint8_t logId, const char* pattern, Stream& serial)
+{
+    if (!logStarted) {
+        configure();
+    }
+    if (logSerial.setLogPattern(logId, pattern, serial)) {
+        sequenceNumbers = true;
+    }
 }
 
 uint8_t Elog::getSerialLastMsgLogLevel(const uint8_t logId, Stream& serial)
@@ -254,6 +655,10 @@ void Elog::registerSpiffs(const uint8_t logId, const uint8_t logLevel, const cha
         return;
     }
     logSpiffs.registerSpiffs(logId, logLevel, fileName, logFlags, maxLogFileSize);
+    if (logFlags & ELOG_FLAG_SEQUENCE) {
+        sequenceNumbers = true;
+    }
+    updateLogLevelLimits();
 }
 
 uint8_t Elog::getSpiffsLogLevel(const uint8_t logId, const char* fileName)
@@ -274,6 +679,23 @@ void Elog::setSpiffsLogLevel(const uint8_t logId, const uint8_t logLevel, const
         return;
     }
     logSpiffs.setLogLevel(logId, logLevel, fileName);
+    updateLogLevelLimits();
+}
+
+/** Stamp the log lines of a SPIFFS log file with a pattern instead of its log flags (see setSerialLogPattern).
+ * %S is empty, as log files have no service name
+ * @param logId the id of the log
+ * @param pattern the log pattern
+ * @param fileName the file name of the registration
+ */
+void Elog::setSpiffsLogPattern(const uint8_t logId, const char* pattern, const char* fileName)
+{
+    if (!logStarted) {
+        configure();
+    }
+    if (logSpiffs.setLogPattern(logId, pattern, fileName)) {
+        sequenceNumbers = true;
+    }
 }
 
 uint8_t Elog::getSpiffsLastMsgLogLevel(const uint8_t logId, const char* fileName)
@@ -321,6 +743,10 @@ void Elog::registerSd(const uint8_t logId, const uint8_t logLevel, const char* f
         return;
     }
     logSD.registerSd(logId, logLevel, fileName, logFlags, maxLogFileSize);
+    if (logFlags & ELOG_FLAG_SEQUENCE) {
+        sequenceNumbers = true;
+    }
+    updateLogLevelLimits();
 }
 
 uint8_t Elog::getSdLogLevel(const uint8_t logId, const char* fileName)
@@ -341,6 +767,23 @@ void Elog::setSdLogLevel(const uint8_t logId, const uint8_t logLevel, const char
         return;
     }
     logSD.setLogLevel(logId, logLevel, fileName);
+    updateLogLevelLimits();
+}
+
+/** Stamp the log lines of a SD log file with a pattern instead of its log flags (see setSerialLogPattern).
+ * %S is empty, as log files have no service name
+ * @param logId the id of the log
+ * @param pattern the log pattern
+ * @param fileName the file name of the registration
+ */
+void Elog::setSdLogPattern(const uint8_t logId, const char* pattern, const char* fileName)
+{
+    if (!logStarted) {
+        configure();
+    }
+    if (logSD.setLogPattern(logId, pattern, fileName)) {
+        sequenceNumbers = true;
+    }
 }
 
 uint8_t Elog::getSdLastMsgLogLevel(const uint8_t logId, const char* fileName)
@@ -387,6 +830,7 @@ void Elog::registerSyslog(const uint8_t logId, const uint8_t logLevel, const uin
         return;
     }
     logSyslog.registerSyslog(logId, logLevel, facility, appName);
+    updateLogLevelLimits();
 }
 
 uint8_t Elog::getSyslogLogLevel(const uint8_t logId, const uint8_t facility)
@@ -407,6 +851,7 @@ void Elog::setSyslogLogLevel(const uint8_t logId, const uint8_t logLevel, const
         return;
     }
     logSyslog.setLogLevel(logId, logLevel, facility);
+    updateLogLevelLimits();
 }
 
 uint8_t Elog::getSyslogLastMsgLogLevel(const uint8_t logId, const uint8_t facility)
@@ -453,6 +898,164 @@ void Elog::enableQuery(Stream& serialPort)
     Logger.logInternal(ELOG_LEVEL_INFO, "Query enabled on serial port! Send a space character to activate the query mode");
 }
 
+/**
+ * Enable deferred formatting. Log messages are no longer formatted by the task that logs them. Instead the
+ * format pointer and a binary copy of the arguments are buffered and the writer task formats the message.
+ * This makes logging much faster for the caller, but the format string must stay valid until the message
+ * is written (string literals and F() strings are fine). %s strings are copied, so they need not stay valid.
+ * Rendered messages are truncated to ELOG_DEFERRED_LINE_SIZE
+ */
+void Elog::enableDeferredFormatting()
+{
+    deferredFormatting = true;
+    logInternal(ELOG_LEVEL_INFO, "Deferred formatting enabled");
+}
+
+/**
+ * Suppress repeated log messages. When a message is logged again with the same log id and level, it is not buffered.
+ * When another message comes for the log id, or the window has passed, a "Last message repeated N times" line is logged
+ * instead of the repeats. The check is done before the message is buffered, so repeats use no buffer space or output.
+ * Messages logged with logHex and logHexDump are not checked
+ * @param windowMilliseconds how long repeats of a message are collected into one summary line. Default is 1000 ms
+ */
+void Elog::enableDedup(uint32_t windowMilliseconds)
+{
+    portENTER_CRITICAL(&dedupLock);
+    for (uint8_t i = 0; i < ELOG_DEDUP_SLOTS; i++) {
+        dedupSlots[i].used = false;
+    }
+    portEXIT_CRITICAL(&dedupLock);
+    dedupWindow = max(windowMilliseconds, (uint32_t)1);
+    logInternal(ELOG_LEVEL_INFO, "Repeated messages suppressed for %u ms", dedupWindow);
+}
+
+/**
+ * Sample messages of a log id and level, for example to keep 1 in 100 DEBUG lines of telemetry logged at 1 kHz.
+ * Messages sampled out are dropped before they are formatted, and counted in the log stats and status query command
+ * @param logId the id of the log
+ * @param logLevel the level of the messages to sample. Other levels of the log id are not sampled
+ * @param keepOneIn keep 1 in this many messages. 1 keeps all messages
+ * @param random false keeps exactly every keepOneIn'th message. true keeps each message with chance 1 / keepOneIn,
+ * so messages logged in a fixed pattern are not always kept or always dropped together
+ */
+void Elog::setSampling(uint8_t logId, uint8_t logLevel, uint16_t keepOneIn, bool random)
+{
+    keepOneIn = max(keepOneIn, (uint16_t)1);
+
+    portENTER_CRITICAL(&samplingLock);
+    uint8_t count = samplingCount.load();
+    uint8_t index = 0;
+    while (index < count && (samplings[index].logId != logId || samplings[index].logLevel != logLevel)) {
+        index++;
+    }
+    if (index < ELOG_SAMPLINGS_MAX) {
+        Sampling& sampling = samplings[index];
+        sampling.mode.store(keepOneIn | (random ? SAMPLING_RANDOM : 0)); // keepOneIn and random change together
+        if (index == count) {
+            sampling.logId = logId;
+            sampling.logLevel = logLevel;
+            sampling.seen.store(0);
+            sampling.sampledOut.store(0);
+            samplingCount.store(count + 1); // Publish after the sampling is set up
+        }
+        samplingLogIds[logId / 32].fetch_or(1UL << (logId % 32));
+    }
+    portEXIT_CRITICAL(&samplingLock);
+
+    if (index == ELOG_SAMPLINGS_MAX) {
+        logInternal(ELOG_LEVEL_ERROR, "Max number of samplings reached : %d", ELOG_SAMPLINGS_MAX);
+        return;
+    }
+    logInternal(ELOG_LEVEL_INFO, "Sampling of log id %d level %d set to 1 in %d%s", logId, logLevel, keepOneIn, random ? ", random" : "");
+}
+
+/**
+ * Limit how many messages a log id can log. Each log id has a bucket holding up to burst messages. It is refilled
+ * with messagesPerSecond messages every second. A message is only logged if there is one in the bucket, so one busy
+ * part of the program can not fill the buffer and the bandwidth of SD and syslog.
+ * The messages suppressed are counted. Their number is logged as a warning every ELOG_RATE_LIMIT_NOTICE_MS
+ * and shown by the status query command.
+ * The limit is checked before a message is formatted. A message that is then suppressed as a repeat (see enableDedup)
+ * or discarded because the buffer is full has still used up its place in the bucket
+ * @param logId the id of the log
+ * @param messagesPerSecond the average number of messages logged per second. 0 removes the limit
+ * @param burst the number of messages that can be logged at once after a quiet period
+ */
+void Elog::setRateLimit(uint8_t logId, uint16_t messagesPerSecond, uint16_t burst)
+{
+    uint8_t index = rateLimitIndex[logId];
+    if (index == 0) {
+        if (rateLimitCount >= ELOG_RATE_LIMITS_MAX) {
+            logInternal(ELOG_LEVEL_ERROR, "Max number of rate limits reached : %d", ELOG_RATE_LIMITS_MAX);
+            return;
+        }
+        index = ++rateLimitCount;
+    }
+
+    burst = max(burst, (uint16_t)1);
+    RateLimit& rateLimit = rateLimits[index - 1];
+    portENTER_CRITICAL(&rateLimitLock);
+    rateLimit.logId = logId;
+    rateLimit.messagesPerSecond = messagesPerSecond;
+    rateLimit.burst = burst;
+    rateLimit.tokens = burst * 1000;
+    rateLimit.lastRefill = millis();
+    portEXIT_CRITICAL(&rateLimitLock);
+    rateLimitIndex[logId] = index;
+
+    logInternal(ELOG_LEVEL_INFO, "Rate limit of log id %d set to %d messages per second, burst %d", logId, messagesPerSecond, burst);
+}
+
+/**
+ * Set how long a logging task waits for space when the buffer is full and the overflow policy is ELOG_OVERFLOW_BLOCK.
+ * When the time is up, the log message is discarded. Useful for high priority tasks that must not be blocked for long
+ * @param milliseconds the longest time to wait. ELOG_WAIT_FOREVER (default) waits until there is space
+ */
+void Elog::setBufferFullTimeout(uint32_t milliseconds)
+{
+    bufferFullTimeout = milliseconds;
+    logInternal(ELOG_LEVEL_INFO, "Buffer full timeout set to %u ms", milliseconds);
+}
+
+/**
+ * Give severe messages their own small buffer, which the writer task empties before the normal log buffer.
+ * A severe message then reaches the output devices after at most one batch of other messages, no matter how
+ * many messages are waiting in the normal buffer. If the priority lane is full, the message goes to the normal buffer.
+ * The priority lane holds ELOG_PRIORITY_LANE_LINES lines. Severe messages are output before older, less severe ones
+ * @param priorityLevel messages at this level or more severe use the priority lane. Default is CRITICAL
+ * @param writeSerialSynchronously if true, these messages are also written to the serial ports by the task that logs them,
+ * before the call returns. The writer task then skips them for the serial ports
+ */
+void Elog::enablePriorityLane(uint8_t priorityLevel, bool writeSerialSynchronously)
+{
+    if (!logStarted) {
+        configure();
+    }
+    if (priorityLaneEnabled) {
+        logInternal(ELOG_LEVEL_ERROR, "Priority lane already enabled!");
+        return;
+    }
+
+    bool created;
+    if (ringBuffs[0].buffIsByteMode()) {
+        created = priorityBuff.buffCreateBytes(ELOG_PRIORITY_LANE_LINES * PRIORITY_LANE_LINE_BYTES);
+    } else {
+        created = priorityBuff.buffCreate(ELOG_PRIORITY_LANE_LINES);
+    }
+    if (!created) {
+        panic("Failed to create priority lane! Not enough heap memory!");
+        return;
+    }
+
+    this->priorityLevel = priorityLevel;
+    priorityWriteSerial = writeSerialSynchronously;
+    priorityLaneEnabled = true;
+
+    char logLevelStr[10];
+    formatter.getLogLevelStringRaw(logLevelStr, priorityLevel);
+    logInternal(ELOG_LEVEL_INFO, "Priority lane enabled for level %s and more severe%s", logLevelStr, writeSerialSynchronously ? ". Written synchronously to serial" : "");
+}
+
 /**
  * Provide the time to the Logger. This will set the RTC clock time (used for timestamping log files)
  * You can also just point set the time with NTP using configTime() from time.h
@@ -471,6 +1074,7 @@ void Elog::provideTime(const uint16_t year, const uint8_t month, const uint8_t d
     struct tm timeInfo = { second, minute, hour, day, month - 1, year - 1900 };
     struct timeval tv = { mktime(&timeInfo), 0 };
     settimeofday(&tv, NULL);
+    formatter.timeChanged();
 }
 
 /**
@@ -478,14 +1082,14 @@ void Elog::provideTime(const uint16_t year, const uint8_t month, const uint8_t d
  */
 void Elog::writerTaskStart()
 {
-    TaskHandle_t handleWriterTask = (TaskHandle_t)xTaskCreate(
+    BaseType_t created = xTaskCreate(
         writerTask, // Task function.
         "writeTask", // String with name of task.
         5000, // Stack size in bytes. This seems enough for it not to crash.
         this, // Parameter passed as input of the task.
         1, // Priority of the task.
-        NULL); // Task handle.
-    if (handleWriterTask == NULL) {
+        &writerTaskHandle); // Task handle. Used by logging tasks to wake the writer task
+    if (created != pdPASS) {
         panic("Failed to create log task!");
         return;
     }
@@ -502,75 +1106,488 @@ void Elog::writerTask(void* parameter)
     Elog& elog = *(Elog*)parameter;
     while (true) {
         elog.outputStats();
-        elog.outputFromBuffer();
+        elog.dedupFlush();
+        elog.rateLimitNotice();
+        bool bufferEmptied = elog.outputFromBuffer();
         if (elog.queryEnabled) {
             elog.queryHandleSerialInput();
         }
-        vTaskDelay(1);
+        if (bufferEmptied) {
+            elog.writerWait();
+        } else {
+            vTaskDelay(1); // Still busy. Let other tasks run and feed the watchdog
+        }
+    }
+}
+
+/**
+ * Put the writer task to sleep until there is something to output
+ * When the first message arrives it waits up to ELOG_WRITER_LATENCY_MS more, so messages are output in batches.
+ * The wait ends early when writerWatermark messages are waiting or a logging task finds the buffer full
+ */
+void Elog::writerWait()
+{
+    if (writerPending.load() == 0) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(queryEnabled ? WRITER_QUERY_POLL_MS : WRITER_IDLE_MS));
+        if (writerPending.load() == 0) {
+            return; // Woken by timeout to output stats or handle query input
+        }
+    }
+    if (writerPending.load() < writerWatermark) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ELOG_WRITER_LATENCY_MS));
+    }
+}
+
+/**
+ * Called by logging tasks for every message added to the buffer. Wakes the writer task for the first message
+ * after it started a batch, and again when the watermark is reached
+ */
+void Elog::writerNotify()
+{
+    uint32_t pending = writerPending.fetch_add(1) + 1;
+    if (pending == 1 || pending == writerWatermark) {
+        writerWake();
     }
 }
 
 /**
- * Output the logs from the ring buffer to the output devices
+ * Wake the writer task right away
+ */
+void Elog::writerWake()
+{
+    if (writerTaskHandle != NULL) {
+        xTaskNotifyGive(writerTaskHandle);
+    }
+}
+
+/**
+ * Output all logs in the ring buffer to the output devices. Log lines are handed to the devices in batches
+ * of up to WRITER_BATCH_SIZE lines, so each device can write them together
  * if query mode is enabled, serial output will be disabled
+ * @return false if output was stopped after WRITER_BATCH_MAX_MS and more logs may be waiting
  */
-void Elog::outputFromBuffer()
+bool Elog::outputFromBuffer()
 {
-    uint32_t started = millis();
-    if (!ringBuff.buffIsEmpty()) {
-        LogLineEntry logLineEntry;
-        ringBuff.buffPop(logLineEntry);
+    writerPending.store(0); // Messages added from now on are part of this batch or wake the writer task again
+    uint32_t batchStarted = millis();
+    while (true) {
+        uint32_t started = millis();
+        uint16_t count = 0;
+        size_t deferredUsed = 0;
+        while (count < WRITER_BATCH_SIZE && sizeof(deferredMessages) - deferredUsed >= ELOG_DEFERRED_LINE_SIZE && popLogLine(batchPopped[count])) {
+            batchOutput[count] = batchPopped[count];
+            batchOutput[count].batchIndex = count;
+            if (batchOutput[count].flags & LOG_LINE_INLINE) {
+                batchOutput[count].logMessage = batchOutput[count].inlineMessage;
+            }
+            if (batchOutput[count].format != nullptr) { // deferred formatting. Render the message from the encoded arguments
+                char* rendered = deferredMessages + deferredUsed;
+                deferredUsed += LogArgs::render(rendered, ELOG_DEFERRED_LINE_SIZE, batchOutput[count].format, (const uint8_t*)batchOutput[count].logMessage) + 1;
+                batchOutput[count].logMessage = rendered;
+            }
+            count++;
+        }
+        if (count == 0) {
+            signalSpaceFreed(); // A task may have started waiting after the last batch freed its space
+            return true;
+        }
 
         bool muteSerial = queryState != QUERY_DISABLED; // if query mode is enabled, mute the serial output
+        logSerial.outputFromBuffer(batchOutput, count, muteSerial);
+        logSD.outputFromBuffer(batchOutput, count);
+        logSpiffs.outputFromBuffer(batchOutput, count);
+        logSyslog.outputFromBuffer(batchOutput, count);
 
-        logSerial.outputFromBuffer(logLineEntry, muteSerial);
-        logSD.outputFromBuffer(logLineEntry);
-        logSpiffs.outputFromBuffer(logLineEntry);
-        logSyslog.outputFromBuffer(logLineEntry);
+        releaseLogLines(batchPopped, count); // free the memory used by the log messages
+        signalSpaceFreed();
 
-        delete logLineEntry.logMessage; // clear the memory allocated for the log message
+        if (millis() - started > 1000) {
+            logInternal(ELOG_LEVEL_WARNING, "It took more than a second to process the last %d log messages! Time used: %d ms", count, millis() - started);
+        }
+        if (millis() - batchStarted >= WRITER_BATCH_MAX_MS) {
+            return false;
+        }
     }
-    if (millis() - started > 1000) {
-        logInternal(ELOG_LEVEL_WARNING, "It took more than a second to process the last log message! Time used: %d ms", millis() - started);
+}
+
+/**
+ * Reserve memory for a log message. In byte mode the message is stored directly in the ring buffer arena.
+ * Otherwise short messages are stored in the log line entry itself and longer ones are allocated from heap.
+ * If the buffer is full it waits or discards depending on the overflow policy
+ * @param logLineEntry the log line entry the message belongs to
+ * @param messageSize the length of the message without null terminator. Reduced if the message can never fit in the buffer
+ * @return where the message must be written (messageSize + 1 bytes), or nullptr if the message is discarded
+ */
+char* Elog::reserveLogLine(LogLineEntry& logLineEntry, uint16_t& messageSize)
+{
+    // Orders messages from different cores with the same timestamp. Only needed with a buffer per core, or when shown
+    logLineEntry.sequence = ringBuffCount > 1 || sequenceNumbers.load(std::memory_order_relaxed) ? logSequence.fetch_add(1, std::memory_order_relaxed) : 0;
+    if (priorityWriteSerial && isPriority(logLineEntry.logLevel) && (logLineEntry.format != nullptr || messageSize < ELOG_DEFERRED_LINE_SIZE)) {
+        logLineEntry.flags |= LOG_LINE_SYNCHRONOUS; // Short enough to be copied by writeSerialSynchronous. Longer ones are left to the writer task
     }
+
+    if (isPriority(logLineEntry.logLevel) && priorityBuff.buffIsByteMode() && messageSize <= priorityBuff.buffMaxRecordBody()) {
+        char* message = priorityBuff.buffReserveRecord(logLineEntry, messageSize);
+        if (message != nullptr) {
+            return message;
+        }
+    }
+
+    LogRingBuff<LogLineEntry>& ringBuff = producerRingBuff();
+    if (!ringBuff.buffIsByteMode()) {
+        if (messageSize < sizeof(logLineEntry.inlineMessage)) {
+            logLineEntry.flags |= LOG_LINE_INLINE;
+            return logLineEntry.inlineMessage;
+        }
+        char* message = messageSlab.slabAllocate(messageSize + 1); // reserve memory for the log message + null terminator
+        if (message == nullptr) {
+            countDiscarded(logLineEntry.logLevel); // Not even heap memory left
+        }
+        return message;
+    }
+
+    if (messageSize > ringBuff.buffMaxRecordBody()) {
+        messageSize = ringBuff.buffMaxRecordBody(); // Message is truncated to what the arena can hold
+    }
+
+    if (!levelHasRoom(ringBuff, logLineEntry.logLevel)) {
+        countDiscarded(logLineEntry.logLevel);
+        return nullptr;
+    }
+
+    char* message = ringBuff.buffReserveRecord(logLineEntry, messageSize);
+    if (message == nullptr && mayWaitForSpace()) { // BUFFER FULL - wait for the writer task to make room
+        uint32_t waitStarted = millis();
+        spaceWaiters++;
+        message = ringBuff.buffReserveRecord(logLineEntry, messageSize); // Space freed before this task was counted gives no wakeup
+        while (message == nullptr && waitForSpace(waitStarted)) {
+            message = ringBuff.buffReserveRecord(logLineEntry, messageSize);
+        }
+        spaceWaiters--;
+    }
+    if (message == nullptr) {
+        countDiscarded(logLineEntry.logLevel);
+    }
+    return message;
 }
+
 /**
- * Add a log line to the buffer
+ * Hand a log message returned by reserveLogLine over to the writer task
  * @param logLineEntry the log line entry
+ * @param message the formatted log message
  */
-void Elog::buffAddLogLine(LogLineEntry& logLineEntry)
+void Elog::commitLogLine(LogLineEntry& logLineEntry, char* message)
 {
-    if (ringBuff.buffPush(logLineEntry)) {
+    if (logLineEntry.flags & LOG_LINE_SYNCHRONOUS) {
+        writeSerialSynchronous(logLineEntry, message);
+    } else {
+        handOverLogLine(logLineEntry, message);
+    }
+}
+
+/**
+ * Add a log message returned by reserveLogLine to the buffer and wake the writer task when needed
+ * @param logLineEntry the log line entry
+ * @param message the formatted log message
+ */
+void Elog::handOverLogLine(LogLineEntry& logLineEntry, char* message)
+{
+    if (ringBuffs[0].buffIsByteMode()) {
+        LogRingBuff<LogLineEntry>::buffCommitRecord(message);
         bufferStats.messagesBuffered++;
+        if (isPriority(logLineEntry.logLevel)) {
+            writerWake();
+        } else {
+            writerNotify();
+        }
     } else {
-        if (waitIfBufferFull) { // BUFFER FULL - bad, it will just be discarded.
-            while (ringBuff.buffIsFull()) { // Get one space in buffer to add the message
-                delayMicroseconds(100);
-            }
-            ringBuff.buffPush(logLineEntry);
-            bufferStats.messagesBuffered++;
+        logLineEntry.logMessage = message;
+        buffAddLogLine(logLineEntry);
+    }
+}
+
+/**
+ * Hand a priority message over to the writer task and write it to the serial ports from the task that logs it
+ * (see enablePriorityLane). The message is copied first and committed before the slow serial write, so the writer
+ * task is not held up by it. The writer task may free the message as soon as it is committed
+ * @param logLineEntry the log line entry
+ * @param message the formatted log message, or the encoded arguments if formatting is deferred
+ */
+void Elog::writeSerialSynchronous(LogLineEntry& logLineEntry, char* message)
+{
+    char rendered[ELOG_DEFERRED_LINE_SIZE];
+    LogLineEntry synchronousEntry = logLineEntry;
+
+    if (logLineEntry.format != nullptr) { // deferred formatting. Render the message from the encoded arguments
+        LogArgs::render(rendered, sizeof(rendered), logLineEntry.format, (const uint8_t*)message);
+    } else {
+        strncpy(rendered, message, sizeof(rendered) - 1); // Fits, as reserveLogLine only marks short messages synchronous
+        rendered[sizeof(rendered) - 1] = '\0';
+    }
+    synchronousEntry.logMessage = rendered;
+    synchronousEntry.format = nullptr;
+
+    handOverLogLine(logLineEntry, message);
+    logSerial.writeSynchronous(synchronousEntry, queryState != QUERY_DISABLED);
+}
+
+/**
+ * Get the oldest log line from the buffer. The log message stays valid until releaseLogLines is called
+ * With a buffer per core, the first line of each buffer is kept aside and the oldest of them is returned.
+ * Only lines already added to a buffer are compared, so the order is approximate: a line whose task was interrupted
+ * between taking its timestamp and adding it can come after a newer line from the other core
+ * @param logLineEntry the log line entry
+ * @return true if a log line was available
+ */
+bool Elog::popLogLine(LogLineEntry& logLineEntry)
+{
+    if (priorityLaneEnabled && popRingBuff(priorityBuff, logLineEntry)) {
+        return true;
+    }
+
+    int8_t oldest = -1;
+    for (uint8_t i = 0; i < ringBuffCount; i++) {
+        if (!ringBuffHeadValid[i]) {
+            ringBuffHeadValid[i] = popRingBuff(ringBuffs[i], ringBuffHeads[i]);
+        }
+        if (ringBuffHeadValid[i] && (oldest < 0 || logLineIsOlder(ringBuffHeads[i], ringBuffHeads[oldest]))) {
+            oldest = i;
+        }
+    }
+    if (oldest < 0) {
+        return false;
+    }
+
+    logLineEntry = ringBuffHeads[oldest];
+    ringBuffHeadValid[oldest] = false;
+    return true;
+}
+
+/**
+ * Get the first log line from one ring buffer
+ * @param ringBuff the ring buffer
+ * @param logLineEntry the log line entry
+ * @return true if a log line was available
+ */
+bool Elog::popRingBuff(LogRingBuff<LogLineEntry>& ringBuff, LogLineEntry& logLineEntry)
+{
+    if (ringBuff.buffIsByteMode()) {
+        const char* message;
+        if (!ringBuff.buffPopRecord(logLineEntry, message)) {
+            return false;
+        }
+        logLineEntry.logMessage = message;
+        return true;
+    }
+    return ringBuff.buffPop(logLineEntry);
+}
+
+/**
+ * Returns true if messages of this level use the priority lane
+ * @param logLevel the level of the message
+ */
+bool Elog::isPriority(uint8_t logLevel) const
+{
+    return priorityLaneEnabled && logLevel <= priorityLevel;
+}
+
+/**
+ * Returns true if log line a was logged before log line b. Lines with the same timestamp are ordered by sequence number
+ */
+bool Elog::logLineIsOlder(const LogLineEntry& a, const LogLineEntry& b)
+{
+    if (a.timestamp != b.timestamp) {
+        return a.timestamp < b.timestamp;
+    }
+    return (int32_t)(a.sequence - b.sequence) < 0;
+}
+
+/**
+ * Free the memory used by log lines returned by popLogLine
+ * In byte mode the first line of each buffer kept aside by popLogLine is not output yet, so it is not released
+ * @param logLineEntries the log line entries
+ * @param count the number of log line entries
+ */
+void Elog::releaseLogLines(const LogLineEntry* logLineEntries, uint16_t count)
+{
+    if (!ringBuffs[0].buffIsByteMode()) {
+        for (uint16_t i = 0; i < count; i++) {
+            deleteLogMessage(logLineEntries[i]);
+        }
+        return;
+    }
+
+    for (uint8_t i = 0; i < ringBuffCount; i++) {
+        if (ringBuffHeadValid[i]) {
+            ringBuffs[i].buffReleaseRecordsBefore(ringBuffHeads[i].logMessage);
         } else {
-            bufferStats.messagesDiscarded++;
-            delete logLineEntry.logMessage; // free the memory allocated for the log message
+            ringBuffs[i].buffReleaseRecords();
         }
     }
+    if (priorityLaneEnabled) {
+        priorityBuff.buffReleaseRecords(); // Lines of the priority lane are never kept aside, so all popped lines are output
+    }
 }
 
 /**
- * Check if the log must be output to the output devices
- * @param logId the id of the log
- * @param logLevel the level of the log
- * @return true if the log must be output, false otherwise
+ * Free the memory of a log message in line mode. Messages stored in the log line entry itself are left alone
+ * @param logLineEntry the log line entry
+ */
+void Elog::deleteLogMessage(const LogLineEntry& logLineEntry)
+{
+    if (!(logLineEntry.flags & LOG_LINE_INLINE)) {
+        messageSlab.slabRelease(logLineEntry.logMessage);
+    }
+}
+
+/**
+ * Returns true if the calling task must wait for space when the buffer is full.
+ * The writer task itself never waits, as nobody else would make room
+ */
+bool Elog::mayWaitForSpace()
+{
+    return overflowPolicy == ELOG_OVERFLOW_BLOCK && xTaskGetCurrentTaskHandle() != writerTaskHandle;
+}
+
+/**
+ * Block the calling task until the writer task has freed space in the buffer. The task does not use any CPU while
+ * waiting, so the writer task can run even if the logging task has a higher priority
+ * The caller must count itself in spaceWaiters before it last checked for space, so no wakeup is missed
+ * @param waitStarted millis() when the task started waiting
+ * @return false if the task has waited for bufferFullTimeout. The log message must be discarded
+ */
+bool Elog::waitForSpace(uint32_t waitStarted)
+{
+    TickType_t ticks = portMAX_DELAY;
+    if (bufferFullTimeout != ELOG_WAIT_FOREVER) {
+        uint32_t waited = millis() - waitStarted;
+        if (waited >= bufferFullTimeout) {
+            return false;
+        }
+        ticks = max(pdMS_TO_TICKS(bufferFullTimeout - waited), (TickType_t)1);
+    }
+    writerWake();
+    xSemaphoreTake(spaceFreed, ticks);
+    return true;
+}
+
+/**
+ * Wake the logging tasks waiting for space. Called by the writer task after releasing log lines
  */
-bool Elog::mustLog(uint8_t logId, uint8_t logLevel)
+void Elog::signalSpaceFreed()
 {
-    bool status = false;
-    status |= logSerial.mustLog(logId, logLevel);
-    status |= logSD.mustLog(logId, logLevel);
-    status |= logSpiffs.mustLog(logId, logLevel);
-    status |= logSyslog.mustLog(logId, logLevel);
-    status |= (queryState == QUERY_WAITING_FOR_PEEK_QUIT); // if in peek mode, always log
-    return status;
+    for (uint16_t waiters = spaceWaiters.load(); waiters > 0; waiters--) {
+        if (xSemaphoreGive(spaceFreed) != pdTRUE) {
+            break; // Already given to the maximum. Enough tasks will wake
+        }
+    }
+}
+
+/**
+ * Returns true if a message of this level may use the free space in the buffer.
+ * With ELOG_OVERFLOW_DROP_LOWEST_LEVEL the last part of the buffer is kept for the more severe messages,
+ * so they still get in when less severe messages are discarded
+ * @param ringBuff the ring buffer the message goes to
+ * @param logLevel the level of the message
+ */
+bool Elog::levelHasRoom(LogRingBuff<LogLineEntry>& ringBuff, uint8_t logLevel)
+{
+    if (overflowPolicy != ELOG_OVERFLOW_DROP_LOWEST_LEVEL || logLevel <= ELOG_LEVEL_CRITICAL) {
+        return true;
+    }
+    uint8_t fillLimit = logLevel <= ELOG_LEVEL_WARNING ? OVERFLOW_FILL_LIMIT_WARNING : OVERFLOW_FILL_LIMIT_OTHER;
+    return ringBuff.buffPercentageFull() < fillLimit;
+}
+
+/**
+ * Count a discarded log message
+ * @param logLevel the level of the message
+ */
+void Elog::countDiscarded(uint8_t logLevel)
+{
+    bufferStats.messagesDiscarded++;
+    if (logLevel < ELOG_NUM_LOG_LEVELS) {
+        bufferStats.discardedPerLevel[logLevel]++;
+    }
+}
+
+/**
+ * Format the discarded messages per level, like "WARN:3 INFO:120". Levels with nothing discarded are left out
+ * @param output the output string
+ * @param outputSize the size of the output string
+ */
+void Elog::formatDiscardedPerLevel(char* output, size_t outputSize)
+{
+    char logLevelStr[10];
+    size_t used = 0;
+
+    output[0] = 0;
+    for (uint8_t i = 0; i < ELOG_NUM_LOG_LEVELS && used < outputSize; i++) {
+        uint32_t discarded = bufferStats.discardedPerLevel[i].load();
+        if (discarded > 0) {
+            formatter.getLogLevelStringRaw(logLevelStr, i);
+            used += snprintf(output + used, outputSize - used, "%s%s:%u", used > 0 ? " " : "", logLevelStr, discarded);
+        }
+    }
+}
+
+/**
+ * Add a log line to the buffer
+ * @param logLineEntry the log line entry
+ */
+void Elog::buffAddLogLine(LogLineEntry& logLineEntry)
+{
+    if (isPriority(logLineEntry.logLevel) && priorityBuff.buffPush(logLineEntry)) {
+        bufferStats.messagesBuffered++;
+        writerWake(); // Output right away
+        return;
+    }
+
+    LogRingBuff<LogLineEntry>& ringBuff = producerRingBuff();
+    bool pushed = levelHasRoom(ringBuff, logLineEntry.logLevel) && ringBuff.buffPush(logLineEntry);
+    if (!pushed && mayWaitForSpace()) { // BUFFER FULL - wait for the writer task to make room
+        uint32_t waitStarted = millis();
+        spaceWaiters++;
+        pushed = ringBuff.buffPush(logLineEntry); // Space freed before this task was counted gives no wakeup
+        while (!pushed && waitForSpace(waitStarted)) { // Other tasks may take the space first, so keep trying
+            pushed = ringBuff.buffPush(logLineEntry);
+        }
+        spaceWaiters--;
+    } else if (!pushed && overflowPolicy == ELOG_OVERFLOW_DROP_OLDEST) { // BUFFER FULL - make room by discarding the oldest line
+        LogLineEntry oldest;
+        while (!pushed && ringBuff.buffPop(oldest)) { // The writer task may take lines at the same time, so keep trying
+            countDiscarded(oldest.logLevel);
+            deleteLogMessage(oldest);
+            pushed = ringBuff.buffPush(logLineEntry);
+        }
+    }
+
+    if (pushed) {
+        bufferStats.messagesBuffered++;
+        writerNotify();
+    } else {
+        countDiscarded(logLineEntry.logLevel);
+        deleteLogMessage(logLineEntry); // free the memory allocated for the log message
+    }
+}
+
+/**
+ * Rebuild the table used by mustLog from the registrations of all devices
+ * Must be called whenever a registration, a log level or the peek state changes
+ */
+void Elog::updateLogLevelLimits()
+{
+    uint8_t limits[UINT8_MAX + 1] = { 0 }; // Built aside so logging tasks never see an emptied table
+
+    if (queryState == QUERY_WAITING_FOR_PEEK_QUIT) { // if in peek mode, always log
+        memset(limits, ELOG_LEVEL_VERBOSE + 1, sizeof(limits));
+    } else {
+        logSerial.addLogLevelLimits(limits);
+        logSD.addLogLevelLimits(limits);
+        logSpiffs.addLogLevelLimits(limits);
+        logSyslog.addLogLevelLimits(limits);
+    }
+    memcpy(logLevelLimits, limits, sizeof(logLevelLimits));
 }
 
 /**
@@ -582,33 +1599,84 @@ bool Elog::mustLog(uint8_t logId, uint8_t logLevel)
 void Elog::logInternal(const uint8_t logLevel, const char* format, ...)
 {
     if (queryState == QUERY_DISABLED && logLevel <= internalLogLevel && internalLogLevel != ELOG_LEVEL_NOLOG) {
-        va_list args; // first find size of the log message
+        char scratch[ELOG_SCRATCH_SIZE];
+        char* logLineMessage = scratch; // Most internal messages fit in the scratch buffer on the stack
+
+        va_list args;
         va_start(args, format); // initialize the list
-        uint16_t logLineSize = vsnprintf(NULL, 0, format, args); // check the size of the log message
+        int logLineSize = vsnprintf(scratch, sizeof(scratch), format, args); // format the log message
         va_end(args); // end the list
 
-        char* logLineMessage;
-        try {
-            logLineMessage = new char[logLineSize + 1]; // reserve memory for the log message + null terminator
-        } catch (const std::bad_alloc& e) {
-            panic("Failed to allocate memory for loginternal message! Not logged!");
-            return;
+        if (logLineSize >= (int)sizeof(scratch)) { // Too long for the scratch buffer. Format it again in a message block
+            logLineMessage = messageSlab.slabAllocate(logLineSize + 1); // reserve memory for the log message + null terminator
+            if (logLineMessage == nullptr) {
+                logLineMessage = scratch; // No memory left. The message is written truncated
+            } else {
+                va_start(args, format);
+                vsnprintf(logLineMessage, logLineSize + 1, format, args); // format the log message
+                va_end(args); // end the list
+            }
         }
 
-        va_start(args, format); // then reserve memory for the log message
-        vsnprintf(logLineMessage, logLineSize + 1, format, args); // format the log message
-        va_end(args); // end the list
-
-        LogLineEntry logLineEntry;
-        logLineEntry.timestamp = millis();
+        LogLineHeader logLineEntry;
+        logLineEntry.timestamp = esp_timer_get_time();
+        logLineEntry.sequence = 0;
         logLineEntry.logId = 0; // is not used for internal logs
         logLineEntry.logLevel = logLevel;
-        logLineEntry.internalLogDevice = internalLogDevice;
+        logLineEntry.flags = 0;
         logLineEntry.logMessage = logLineMessage;
+        logLineEntry.format = nullptr;
+
+        logSerial.writeInternal(logLineEntry, internalLogDevice);
+        if (logLineMessage != scratch) {
+            messageSlab.slabRelease(logLineMessage);
+        }
+    }
+}
+
+/**
+ * Returns the ring buffer the calling task must log to. With a buffer per core it is the one of the current core
+ */
+LogRingBuff<LogLineEntry>& Elog::producerRingBuff()
+{
+    return ringBuffs[ringBuffCount > 1 ? xPortGetCoreID() : 0];
+}
+
+/**
+ * Returns the total capacity of all ring buffers. In lines, or in bytes for a byte budgeted buffer
+ */
+size_t Elog::bufferCapacity()
+{
+    size_t capacity = 0;
+    for (uint8_t i = 0; i < ringBuffCount; i++) {
+        capacity += ringBuffs[i].buffCapacity();
+    }
+    return capacity;
+}
 
-        logSerial.outputFromBuffer(logLineEntry, false);
-        free(logLineMessage);
+/**
+ * Returns how many percent of the fullest ring buffer is used
+ */
+uint8_t Elog::bufferPercentageFull()
+{
+    uint8_t maxPct = 0;
+    for (uint8_t i = 0; i < ringBuffCount; i++) {
+        maxPct = max(maxPct, ringBuffs[i].buffPercentageFull());
     }
+    return maxPct;
+}
+
+/**
+ * Returns true if any ring buffer is full
+ */
+bool Elog::bufferIsFull()
+{
+    for (uint8_t i = 0; i < ringBuffCount; i++) {
+        if (ringBuffs[i].buffIsFull()) {
+            return true;
+        }
+    }
+    return false;
 }
 
 /**
@@ -620,21 +1688,32 @@ void Elog::outputStats()
     static bool bufferFullWarningSent = false;
     static uint8_t maxBuffPct = 0;
 
-    if (ringBuff.buffPercentageFull() > maxBuffPct) {
-        maxBuffPct = ringBuff.buffPercentageFull();
+    uint8_t buffPct = bufferPercentageFull();
+    if (buffPct > maxBuffPct) {
+        maxBuffPct = buffPct;
     }
 
-    if (ringBuff.buffPercentageFull() < 50) { // When buffer under half full, we clear "full warning".
+    if (buffPct < 50) { // When buffer under half full, we clear "full warning".
         bufferFullWarningSent = false;
     }
-    if (!bufferFullWarningSent && ringBuff.buffIsFull() && waitIfBufferFull) {
+    if (!bufferFullWarningSent && bufferIsFull() && overflowPolicy == ELOG_OVERFLOW_BLOCK) {
         logInternal(ELOG_LEVEL_WARNING, "Log Buffer was full. Please increase its size.");
         bufferFullWarningSent = true;
     }
 
     static uint32_t lastOutput = 0;
     if (millis() - lastOutput > statsEvery) {
-        logInternal(ELOG_LEVEL_INFO, "Log stats. Messages Buffered: %d, Discarded: %d, Max Buff Pct: %d", bufferStats.messagesBuffered, bufferStats.messagesDiscarded, maxBuffPct);
+        logInternal(ELOG_LEVEL_INFO, "Log stats. Messages Buffered: %d, Discarded: %d, Max Buff Pct: %d", bufferStats.messagesBuffered.load(), bufferStats.messagesDiscarded.load(), maxBuffPct);
+        if (bufferStats.messagesDiscarded.load() > 0) {
+            char discarded[120];
+            formatDiscardedPerLevel(discarded, sizeof(discarded));
+            logInternal(ELOG_LEVEL_INFO, "Log stats. Discarded per level: %s", discarded);
+        }
+        if (samplingCount.load() > 0) {
+            char sampled[120];
+            formatSampledOut(sampled, sizeof(sampled));
+            logInternal(ELOG_LEVEL_INFO, "Log stats. Sampled out per log id/level: %s", sampled);
+        }
         logSD.outputStats();
         logSerial.outputStats();
         logSpiffs.outputStats();
@@ -801,6 +1880,7 @@ void Elog::queryStateWaitPeekQuit(char c)
         queryPrintPrompt();
 
         queryState = QUERY_WAITING_FOR_COMMAND;
+        updateLogLevelLimits();
     }
 }
 
@@ -998,11 +2078,14 @@ void Elog::queryCmdPeek(const char* filename, const char* loglevel, const char*
 
     if (peekStarted) {
         queryState = QUERY_WAITING_FOR_PEEK_QUIT;
+        updateLogLevelLimits();
     } else {
         queryPrintPrompt();
     }
 }
 
+static const char* overflowPolicyNames[] = { "drop newest", "block", "drop oldest", "drop lowest level" };
+
 /**
  * Print the status of the logger
  */
@@ -1019,10 +2102,31 @@ void Elog::queryCmdStatus()
     }
 
     querySerial->println();
-    querySerial->printf("log buffer, capacity: %d\n", ringBuff.buffCapacity());
-    querySerial->printf("log buffer, percentage full: %d\n", ringBuff.buffPercentageFull());
-    querySerial->printf("log buffer, lines buffered: %d\n", bufferStats.messagesBuffered);
-    querySerial->printf("log buffer, lines discarded: %d\n", bufferStats.messagesDiscarded);
+    querySerial->printf("log buffer, capacity: %d %s\n", bufferCapacity(), ringBuffs[0].buffIsByteMode() ? "bytes" : "lines");
+    querySerial->printf("log buffer, percentage full: %d\n", bufferPercentageFull());
+    querySerial->printf("log buffer, lines buffered: %d\n", bufferStats.messagesBuffered.load());
+    querySerial->printf("log buffer, lines discarded: %d\n", bufferStats.messagesDiscarded.load());
+    if (bufferStats.messagesDiscarded.load() > 0) {
+        char discarded[120];
+        formatDiscardedPerLevel(discarded, sizeof(discarded));
+        querySerial->printf("log buffer, discarded per level: %s\n", discarded);
+    }
+    querySerial->printf("log buffer, overflow policy: %s\n", overflowPolicyNames[overflowPolicy]);
+    messageSlab.slabQueryStatus(querySerial);
+    for (uint8_t i = 0; i < samplingCount.load(); i++) {
+        formatter.getLogLevelStringRaw(buffer, samplings[i].logLevel);
+        uint32_t mode = samplings[i].mode.load();
+        querySerial->printf("sampling, log id %d, %s: 1 in %u%s, sampled out: %u\n", samplings[i].logId, buffer,
+            mode & SAMPLING_KEEP_MASK, mode & SAMPLING_RANDOM ? " random" : "", samplings[i].sampledOut.load());
+    }
+    for (uint8_t i = 0; i < rateLimitCount; i++) {
+        querySerial->printf("rate limit, log id %d: %d messages/s, burst %d, suppressed: %u\n", rateLimits[i].logId,
+            rateLimits[i].messagesPerSecond, rateLimits[i].burst, rateLimits[i].suppressedTotal);
+    }
+    if (priorityLaneEnabled) {
+        formatter.getLogLevelStringRaw(buffer, priorityLevel);
+        querySerial->printf("priority lane, level: %s, lines waiting: %d\n", buffer, priorityBuff.buffSize());
+    }
 
     if (logSerial.registeredCount() > 0) {
         logSerial.queryCmdStatus();
@@ -2,13 +2,16 @@
 #define ELOG_H
 
 #include <Arduino.h>
+#include <LogArgs.h>
 #include <LogFormat.h>
 #include <LogRingBuff.h>
 #include <LogSd.h>
 #include <LogSerial.h>
+#include <LogSlab.h>
 #include <LogSpiffs.h>
 #include <LogSyslog.h>
 #include <esp_task_wdt.h>
+#include <esp_timer.h>
 
 // From ArduinoLog.h
 #define CR "\r\n"
@@ -17,6 +20,30 @@
 #define LENGTH_COMMAND_BUFFER 50
 #define LENGTH_ABSOLUTE_PATH 30
 
+#define LOG_BUFFER_CORES portNUM_PROCESSORS // Number of ring buffers when there is a buffer per core
+
+#define WRITER_IDLE_MS 1000 // Longest sleep of the writer task when no messages arrive. Stats are still output
+#define WRITER_QUERY_POLL_MS 20 // Longest sleep of the writer task when query mode is enabled. Serial input is polled
+#define WRITER_BATCH_MAX_MS 100 // Longest time the writer task outputs messages before it handles stats and query input
+#define WRITER_DEFERRED_LINES 4 // Most deferred log messages rendered for one batch
+#define WAITING_TASKS_MAX 16 // Most logging tasks woken at once when the writer task frees space in a full buffer
+
+#define OVERFLOW_FILL_LIMIT_WARNING 90 // ELOG_OVERFLOW_DROP_LOWEST_LEVEL: WARNING and ERROR messages are discarded above this percentage full
+#define OVERFLOW_FILL_LIMIT_OTHER 75 // ELOG_OVERFLOW_DROP_LOWEST_LEVEL: NOTICE and less severe messages are discarded above this percentage full
+
+#define PRIORITY_LANE_LINE_BYTES 128 // Bytes of the priority lane for each line when the log buffer is byte budgeted
+
+#define ELOG_WAIT_FOREVER UINT32_MAX // Buffer full timeout that never expires
+
+#define SAMPLING_KEEP_MASK 0xFFFF // Sampling mode: keepOneIn in the low bits
+#define SAMPLING_RANDOM 0x10000 // Sampling mode: keep each message with chance 1 / keepOneIn instead of every keepOneIn'th message
+
+// Byte budgeted buffers store the message after the header, so the inline message area is left out of the arena
+template <>
+struct LogRingBuffRecordEntry<LogLineEntry> {
+    static size_t size() { return sizeof(LogLineHeader); }
+};
+
 class Elog {
     enum QueryDevice {
         NONE,
@@ -33,9 +60,37 @@ class Elog {
         QUERY_WAITING_FOR_TYPE_CMD = 3
     };
 
-    struct BufferStats {
-        uint32_t messagesBuffered;
-        uint32_t messagesDiscarded;
+    struct DedupSlot { // The last message of a log id when repeated messages are suppressed
+        bool used;
+        uint8_t logId;
+        uint8_t logLevel;
+        uint32_t hash;
+        uint32_t windowStarted; // millis() when the message was logged
+        uint32_t repeats; // Times the message was suppressed since
+    };
+
+    struct Sampling { // Keep 1 in N messages of a log id and level
+        uint8_t logId;
+        uint8_t logLevel;
+        std::atomic<uint32_t> mode; // keepOneIn | SAMPLING_RANDOM. One word, so logging tasks never see half a change. keepOneIn 1 keeps all messages
+        std::atomic<uint32_t> seen;
+        std::atomic<uint32_t> sampledOut;
+    };
+
+    struct RateLimit { // Token bucket of a log id
+        uint8_t logId;
+        uint16_t messagesPerSecond; // 0 is no limit
+        uint16_t burst;
+        uint32_t tokens; // Messages that may be logged right now, in thousandths
+        uint32_t lastRefill; // millis() when tokens were last added
+        uint32_t suppressed; // Messages suppressed since the last notice
+        uint32_t suppressedTotal;
+    };
+
+    struct BufferStats { // Updated by all logging tasks at once
+        std::atomic<uint32_t> messagesBuffered;
+        std::atomic<uint32_t> messagesDiscarded;
+        std::atomic<uint32_t> discardedPerLevel[ELOG_NUM_LOG_LEVELS];
     };
 
     friend class LogTimer;
@@ -50,20 +105,26 @@ public:
     Elog& operator=(const Elog&) = delete;
     static Elog& getInstance();
 
-    void configure(uint16_t logLineCapacity = 50, bool waitIfBufferFull = true);
+    void configure(uint16_t logLineCapacity = 50, bool waitIfBufferFull = true, bool bufferPerCore = false);
+    void configure(uint16_t logLineCapacity, LogOverflowPolicy overflowPolicy, bool bufferPerCore = false);
+    void configureBytes(uint32_t logBufferBytes, bool waitIfBufferFull = true, bool bufferPerCore = false);
+    void configureBytes(uint32_t logBufferBytes, LogOverflowPolicy overflowPolicy, bool bufferPerCore = false);
     void log(uint8_t logId, uint8_t logLevel, const char* format, ...);
     void log(uint8_t logId, uint8_t logLevel, const __FlashStringHelper* format, ...);
     void logHex(uint8_t logId, uint8_t logLevel, const char* message, const uint8_t* data, uint16_t length);
+    void logHexDump(uint8_t logId, uint8_t logLevel, const char* message, const uint8_t* data, uint16_t length);
     void configureSerial(const uint8_t maxRegistrations = 10);
     void registerSerial(const uint8_t logId, const uint8_t logLevel, const char* serviceName, Stream& serial = Serial, const uint8_t logFlags = 0);
     uint8_t getSerialLogLevel(const uint8_t logId, Stream& serial = Serial);
     void setSerialLogLevel(const uint8_t logId, const uint8_t logLevel, Stream& serial = Serial);
+    void setSerialLogPattern(const uint8_t logId, const char* pattern, Stream& serial = Serial);
     uint8_t getSerialLastMsgLogLevel(const uint8_t logId, Stream& serial = Serial);
 #ifdef ELOG_SPIFFS_ENABLE
     void configureSpiffs(const uint8_t maxRegistrations = 10);
     void registerSpiffs(const uint8_t logId, const uint8_t logLevel, const char* fileName, const uint8_t logFlags = ELOG_FLAG_NONE, const uint32_t maxLogFileSize = 100000);
     uint8_t getSpiffsLogLevel(const uint8_t logId, const char* fileName);
     void setSpiffsLogLevel(const uint8_t logId, const uint8_t logLevel, const char* fileName);
+    void setSpiffsLogPattern(const uint8_t logId, const char* pattern, const char* fileName);
     uint8_t getSpiffsLastMsgLogLevel(const uint8_t logId, const char* fileName);
 #endif // ELOG_SPIFFS_ENABLE
 #ifdef ELOG_SD_ENABLE
@@ -71,6 +132,7 @@ public:
     void registerSd(const uint8_t logId, const uint8_t logLevel, const char* fileName, const uint8_t logFlags = ELOG_FLAG_NONE, const uint32_t maxLogFileSize = 100000);
     uint8_t getSdLogLevel(const uint8_t logId, const char* fileName);
     void setSdLogLevel(const uint8_t logId, const uint8_t logLevel, const char* fileName);
+    void setSdLogPattern(const uint8_t logId, const char* pattern, const char* fileName);
     uint8_t getSdLastMsgLogLevel(const uint8_t logId, const char* fileName);
 #endif // ELOG_SD_ENABLE
 #ifdef ELOG_SYSLOG_ENABLE
@@ -83,72 +145,148 @@ public:
 #endif // ELOG_SYSLOG_ENABLE
     void configureInternalLogging(Stream& internalLogDevice, uint8_t internalLogLevel = ELOG_LEVEL_ERROR, uint16_t statsEvery = 10000);
     void enableQuery(Stream& serialPort);
+    void enableDeferredFormatting();
+    void enableDedup(uint32_t windowMilliseconds = 1000);
+    void setRateLimit(uint8_t logId, uint16_t messagesPerSecond, uint16_t burst);
+    void setSampling(uint8_t logId, uint8_t logLevel, uint16_t keepOneIn, bool random = false);
+    void setBufferFullTimeout(uint32_t milliseconds);
+    void enablePriorityLane(uint8_t priorityLevel = ELOG_LEVEL_CRITICAL, bool writeSerialSynchronously = false);
     void provideTime(const uint16_t year, const uint8_t month, const uint8_t day, const uint8_t hour, const uint8_t minute, const uint8_t second);
 
+    /** Log a message. Like log, but with deferred formatting enabled the arguments are encoded using their types
+     * known at compile time, so the format string is not parsed when logging. Used by verbose() ... always() and ELOG_LOG
+     * A format that does not match the types (like %s with a pointer to uint8_t) is handled by log like printf would
+     */
+    template <class T, typename ...Args>
+    void logTyped(uint8_t logId, uint8_t logLevel, T format, Args ...args)
+    {
+        if (!deferredFormatting || !LogArgs::formatMatches<Args...>((const char*)format)) {
+            log(logId, logLevel, format, args...);
+            return;
+        }
+        if (!logAccepted(logId, logLevel)) {
+            return;
+        }
+
+        if (dedupWindow != 0 && logIsRepeated(logId, logLevel, LogArgs::hashValues(LOG_HASH_BASIS ^ (uintptr_t)format, args...))) {
+            return;
+        }
+
+        size_t encodedSize = LogArgs::encodedSize(args...);
+
+        LogLineEntry logLineEntry;
+        logLineEntry.timestamp = esp_timer_get_time();
+        logLineEntry.logId = logId;
+        logLineEntry.logLevel = logLevel;
+        logLineEntry.flags = 0;
+        logLineEntry.logMessage = nullptr;
+        logLineEntry.format = (const char*)format;
+
+        uint16_t logLineSize = encodedSize > UINT16_MAX ? UINT16_MAX : encodedSize;
+        char* logLineMessage = reserveLogLine(logLineEntry, logLineSize); // reserve memory for the encoded arguments
+        if (logLineMessage == nullptr) {
+            return;
+        }
+        LogArgs::encodeValues((uint8_t*)logLineMessage, logLineSize, args...);
+        commitLogLine(logLineEntry, logLineMessage);
+    }
+
+    /** Returns true if a message with logLevel for logId would be output by any device. Used by the ELOG_LOG macros
+     * to skip evaluating the arguments of messages nobody wants
+     * @param logId the id of the log
+     * @param logLevel the level of the log
+     */
+    inline bool mustLog(uint8_t logId, uint8_t logLevel) const
+    {
+        return logLevel < logLevelLimits[logId];
+    }
+
     template <class T, typename ...Args>
     inline void verbose(uint16_t logId, T format, Args ...args)
     {
-        log(logId, ELOG_LEVEL_VERBOSE, format, args...);
+        if (ELOG_LEVEL_VERBOSE <= ELOG_MIN_LEVEL) {
+            logTyped(logId, ELOG_LEVEL_VERBOSE, format, args...);
+        }
     }
 
     template <class T, typename ...Args>
     inline void trace(uint16_t logId, T format, Args ...args)
     {
-        log(logId, ELOG_LEVEL_TRACE, format, args...);
+        if (ELOG_LEVEL_TRACE <= ELOG_MIN_LEVEL) {
+            logTyped(logId, ELOG_LEVEL_TRACE, format, args...);
+        }
     }
 
     template <class T, typename ...Args>
     inline void debug(uint16_t logId, T format, Args ...args)
     {
-        log(logId, ELOG_LEVEL_DEBUG, format, args...);
+        if (ELOG_LEVEL_DEBUG <= ELOG_MIN_LEVEL) {
+            logTyped(logId, ELOG_LEVEL_DEBUG, format, args...);
+        }
     }
 
     template <class T, typename ...Args>
     inline void info(uint16_t logId, T format, Args ...args)
     {
-        log(logId, ELOG_LEVEL_INFO, format, args...);
+        if (ELOG_LEVEL_INFO <= ELOG_MIN_LEVEL) {
+            logTyped(logId, ELOG_LEVEL_INFO, format, args...);
+        }
     }
 
     template <class T, typename ...Args>
     inline void notice(uint16_t logId, T format, Args ...args)
     {
-        log(logId, ELOG_LEVEL_NOTICE, format, args...);
+        if (ELOG_LEVEL_NOTICE <= ELOG_MIN_LEVEL) {
+            logTyped(logId, ELOG_LEVEL_NOTICE, format, args...);
+        }
     }
 
     template <class T, typename ...Args>
     inline void warning(uint16_t logId, T format, Args ...args)
     {
-        log(logId, ELOG_LEVEL_WARNING, format, args...);
+        if (ELOG_LEVEL_WARNING <= ELOG_MIN_LEVEL) {
+            logTyped(logId, ELOG_LEVEL_WARNING, format, args...);
+        }
     }
 
     template <class T, typename ...Args>
     inline void error(uint16_t logId, T format, Args ...args)
     {
-        log(logId, ELOG_LEVEL_ERROR, format, args...);
+        if (ELOG_LEVEL_ERROR <= ELOG_MIN_LEVEL) {
+            logTyped(logId, ELOG_LEVEL_ERROR, format, args...);
+        }
     }
 
     template <class T, typename ...Args>
     inline void critical(uint16_t logId, T format, Args ...args)
     {
-        log(logId, ELOG_LEVEL_CRITICAL, format, args...);
+        if (ELOG_LEVEL_CRITICAL <= ELOG_MIN_LEVEL) {
+            logTyped(logId, ELOG_LEVEL_CRITICAL, format, args...);
+        }
     }
 
     template <class T, typename ...Args>
     inline void alert(uint16_t logId, T format, Args ...args)
     {
-        log(logId, ELOG_LEVEL_ALERT, format, args...);
+        if (ELOG_LEVEL_ALERT <= ELOG_MIN_LEVEL) {
+            logTyped(logId, ELOG_LEVEL_ALERT, format, args...);
+        }
     }
 
     template <class T, typename ...Args>
     inline void emergency(uint16_t logId, T format, Args ...args)
     {
-        log(logId, ELOG_LEVEL_EMERGENCY, format, args...);
+        if (ELOG_LEVEL_EMERGENCY <= ELOG_MIN_LEVEL) {
+            logTyped(logId, ELOG_LEVEL_EMERGENCY, format, args...);
+        }
     }
 
     template <class T, typename ...Args>
     inline void always(uint16_t logId, T format, Args ...args)
     {
-        log(logId, ELOG_LEVEL_ALWAYS, format, args...);
+        if (ELOG_LEVEL_ALWAYS <= ELOG_MIN_LEVEL) {
+            logTyped(logId, ELOG_LEVEL_ALWAYS, format, args...);
+        }
     }
 
 private:
@@ -159,11 +297,27 @@ private:
     LogSD logSD;
     LogSyslog logSyslog;
     Formatting formatter;
-    LogRingBuff<LogLineEntry> ringBuff;
+    LogRingBuff<LogLineEntry> ringBuffs[LOG_BUFFER_CORES];
+    uint8_t ringBuffCount = 1;
+    LogLineEntry ringBuffHeads[LOG_BUFFER_CORES]; // First line of each ring buffer, popped but not yet output
+    bool ringBuffHeadValid[LOG_BUFFER_CORES] = { false };
+    std::atomic<uint32_t> logSequence { 0 };
+    std::atomic<bool> sequenceNumbers { false }; // Set when a registration shows the sequence number (ELOG_FLAG_SEQUENCE)
+    LogSlab messageSlab; // Memory for long log messages in line mode
+    LogRingBuff<LogLineEntry> priorityBuff; // Severe messages. Output by the writer task before the other buffers
+    bool priorityLaneEnabled = false;
+    uint8_t priorityLevel = ELOG_LEVEL_CRITICAL; // Messages at this level or more severe use the priority lane
+    bool priorityWriteSerial = false; // Priority messages are written to serial by the logging task
+
+    TaskHandle_t writerTaskHandle = NULL;
+    std::atomic<uint32_t> writerPending { 0 }; // Messages added since the writer task started its last batch
+    uint32_t writerWatermark = ELOG_WRITER_WATERMARK;
 
     Stream* internalLogDevice = &Serial;
     uint8_t internalLogLevel = ELOG_LEVEL_ERROR; // Tell library user when he is doing something wrong by default
 
+    uint8_t logLevelLimits[UINT8_MAX + 1] = { 0 }; // Per logId: highest log level that must be logged + 1. 0 means nothing
+
     BufferStats bufferStats;
     uint16_t statsEvery = 10000;
 
@@ -175,14 +329,69 @@ private:
     QueryDevice queryDevice = SPIFFS;
 
     bool logStarted = false;
-    bool waitIfBufferFull = false;
-
+    LogOverflowPolicy overflowPolicy = ELOG_OVERFLOW_DROP_NEWEST;
+    uint32_t bufferFullTimeout = ELOG_WAIT_FOREVER; // How long a logging task may wait for space in a full buffer
+    SemaphoreHandle_t spaceFreed = NULL; // Given by the writer task to wake logging tasks waiting for space
+    std::atomic<uint16_t> spaceWaiters { 0 }; // Number of logging tasks waiting for space
+    bool deferredFormatting = false;
+    uint32_t dedupWindow = 0; // Repeated messages are suppressed for this many milliseconds. 0 is disabled
+    DedupSlot dedupSlots[ELOG_DEDUP_SLOTS];
+    portMUX_TYPE dedupLock = portMUX_INITIALIZER_UNLOCKED;
+    Sampling samplings[ELOG_SAMPLINGS_MAX];
+    std::atomic<uint8_t> samplingCount { 0 };
+    std::atomic<uint32_t> samplingLogIds[(UINT8_MAX + 1) / 32] = {}; // One bit per logId that has a sampling
+    portMUX_TYPE samplingLock = portMUX_INITIALIZER_UNLOCKED; // Only for setSampling. Logging tasks read the samplings without it
+    RateLimit rateLimits[ELOG_RATE_LIMITS_MAX];
+    uint8_t rateLimitCount = 0;
+    uint8_t rateLimitIndex[UINT8_MAX + 1] = { 0 }; // Per logId: index in rateLimits + 1. 0 means no rate limit
+    portMUX_TYPE rateLimitLock = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t rateLimitNoticed = 0; // millis() when suppressed messages were last logged
+    LogLineEntry batchPopped[WRITER_BATCH_SIZE]; // Log lines of the batch as they were popped from the buffer
+    LogLineEntry batchOutput[WRITER_BATCH_SIZE]; // The same log lines, with deferred messages rendered
+    char deferredMessages[ELOG_DEFERRED_LINE_SIZE * WRITER_DEFERRED_LINES]; // Deferred log messages are rendered here by the writer task
+
+    void start(LogOverflowPolicy overflowPolicy);
     void writerTaskStart();
     static void writerTask(void* parameter);
-    void outputFromBuffer();
+    void writerWait();
+    void writerNotify();
+    void writerWake();
+    bool mayWaitForSpace();
+    bool waitForSpace(uint32_t waitStarted);
+    bool levelHasRoom(LogRingBuff<LogLineEntry>& ringBuff, uint8_t logLevel);
+    void countDiscarded(uint8_t logLevel);
+    void formatDiscardedPerLevel(char* output, size_t outputSize);
+    void signalSpaceFreed();
+    bool outputFromBuffer();
+    void logv(uint8_t logId, uint8_t logLevel, const char* format, va_list args);
+    void logDeferred(uint8_t logId, uint8_t logLevel, const char* format, va_list args);
+    bool logAccepted(uint8_t logId, uint8_t logLevel);
+    void logText(uint8_t logId, uint8_t logLevel, const char* text, uint16_t length);
+    bool logIsRepeated(uint8_t logId, uint8_t logLevel, uint32_t hash);
+    bool sampledOut(uint8_t logId, uint8_t logLevel);
+    void formatSampledOut(char* output, size_t outputSize);
+    bool rateLimited(uint8_t logId);
+    void rateLimitNotice();
+    void logRepeatSummary(uint8_t logId, uint8_t logLevel, uint32_t repeats);
+    void dedupFlush();
+    static uint32_t dedupHash(const void* data, size_t length, uint32_t seed);
+    char* reserveLogLine(LogLineEntry& logLineEntry, uint16_t& messageSize);
+    void commitLogLine(LogLineEntry& logLineEntry, char* message);
+    void handOverLogLine(LogLineEntry& logLineEntry, char* message);
+    void writeSerialSynchronous(LogLineEntry& logLineEntry, char* message);
+    bool popLogLine(LogLineEntry& logLineEntry);
+    bool popRingBuff(LogRingBuff<LogLineEntry>& ringBuff, LogLineEntry& logLineEntry);
+    bool isPriority(uint8_t logLevel) const;
+    static bool logLineIsOlder(const LogLineEntry& a, const LogLineEntry& b);
+    void releaseLogLines(const LogLineEntry* logLineEntries, uint16_t count);
+    void deleteLogMessage(const LogLineEntry& logLineEntry);
     void buffAddLogLine(LogLineEntry& logLineEntry);
-    bool mustLog(uint8_t logId, uint8_t logLevel);
+    void updateLogLevelLimits();
     void logInternal(const uint8_t logLevel, const char* format, ...);
+    LogRingBuff<LogLineEntry>& producerRingBuff();
+    size_t bufferCapacity();
+    uint8_t bufferPercentageFull();
+    bool bufferIsFull();
     void outputStats();
     void panic(const char* message);
 
@@ -211,4 +420,27 @@ private:
 
 extern Elog& Logger; // Make an instance available to user when he includes the library
 
+// Log with a format string that is checked against the types of the arguments at compile time.
+// A mismatch (like "%s" with an int) fails the build. The format must be a string literal.
+// The arguments are only evaluated if the message is going to be logged. Levels above ELOG_MIN_LEVEL compile to nothing
+#define ELOG_LOG(logId, logLevel, format, ...)                                                                          \
+    do {                                                                                                                \
+        static_assert(LogArgs::checkFormat(format, decltype(logArgTypesOf(__VA_ARGS__))::codes), "Log format does not match the arguments"); \
+        if ((logLevel) <= ELOG_MIN_LEVEL && Logger.mustLog(logId, logLevel)) {                                         \
+            Logger.logTyped(logId, logLevel, format, ##__VA_ARGS__);                                                    \
+        }                                                                                                               \
+    } while (0)
+
+#define ELOG_VERBOSE(logId, format, ...) ELOG_LOG(logId, ELOG_LEVEL_VERBOSE, format, ##__VA_ARGS__)
+#define ELOG_TRACE(logId, format, ...) ELOG_LOG(logId, ELOG_LEVEL_TRACE, format, ##__VA_ARGS__)
+#define ELOG_DEBUG(logId, format, ...) ELOG_LOG(logId, ELOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define ELOG_INFO(logId, format, ...) ELOG_LOG(logId, ELOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define ELOG_NOTICE(logId, format, ...) ELOG_LOG(logId, ELOG_LEVEL_NOTICE, format, ##__VA_ARGS__)
+#define ELOG_WARNING(logId, format, ...) ELOG_LOG(logId, ELOG_LEVEL_WARNING, format, ##__VA_ARGS__)
+#define ELOG_ERROR(logId, format, ...) ELOG_LOG(logId, ELOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#define ELOG_CRITICAL(logId, format, ...) ELOG_LOG(logId, ELOG_LEVEL_CRITICAL, format, ##__VA_ARGS__)
+#define ELOG_ALERT(logId, format, ...) ELOG_LOG(logId, ELOG_LEVEL_ALERT, format, ##__VA_ARGS__)
+#define ELOG_EMERGENCY(logId, format, ...) ELOG_LOG(logId, ELOG_LEVEL_EMERGENCY, format, ##__VA_ARGS__)
+#define ELOG_ALWAYS(logId, format, ...) ELOG_LOG(logId, ELOG_LEVEL_ALWAYS, format, ##__VA_ARGS__)
+
 #endif // ELOG_H
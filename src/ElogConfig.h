@@ -23,4 +23,89 @@
 // Uncomment to enable the LogTimer utility
 // #define ELOG_TIMER_ENABLE
 
+// Log calls with a level above this are removed at compile time. Their arguments are not evaluated when
+// using the ELOG_DEBUG(...) style macros. Default keeps all levels.
+// Set via build_flags (e.g. -D ELOG_MIN_LEVEL=ELOG_LEVEL_INFO) to strip debug, trace and verbose logging
+#ifndef ELOG_MIN_LEVEL
+#define ELOG_MIN_LEVEL ELOG_LEVEL_VERBOSE
+#endif
+
+// Size of the stack buffer that log messages are formatted into. Messages up to this length
+// (including null terminator) are formatted in a single pass. Longer messages are measured and
+// formatted a second time. Can also be set via build_flags (e.g. -D ELOG_SCRATCH_SIZE=256)
+#ifndef ELOG_SCRATCH_SIZE
+#define ELOG_SCRATCH_SIZE 128
+#endif
+
+// Size of a log line entry in a line buffer (Logger.configure). Messages shorter than this minus the 24 byte
+// entry header are stored in the entry itself and need no other memory. A buffer slot takes 8 bytes more,
+// so the default fills one 64 byte cache line. A line then takes about as much memory as a 16 byte entry
+// with its message on the heap did, but needs no allocation. 32 gives 40 byte slots, so the same memory
+// holds more lines, but only messages of up to 7 characters are stored inline. Must be a multiple of 8
+#ifndef ELOG_LINE_ENTRY_SIZE
+#define ELOG_LINE_ENTRY_SIZE 56
+#endif
+
+// Longest log message (including null terminator) the writer task can render when deferred formatting
+// is enabled with Logger.enableDeferredFormatting(). Longer messages are truncated
+#ifndef ELOG_DEFERRED_LINE_SIZE
+#define ELOG_DEFERRED_LINE_SIZE 256
+#endif
+
+// The writer task sleeps until log messages arrive. It is woken when this many messages are waiting, and
+// outputs them all in one batch. Fewer messages are output after at most ELOG_WRITER_LATENCY_MS milliseconds
+#ifndef ELOG_WRITER_WATERMARK
+#define ELOG_WRITER_WATERMARK 16
+#endif
+
+#ifndef ELOG_WRITER_LATENCY_MS
+#define ELOG_WRITER_LATENCY_MS 10
+#endif
+
+// Log messages too long to be stored in the log buffer entry are stored in blocks of 64, 128, 256 and 512 bytes.
+// The blocks are reserved when the logger is configured, so logging does not fragment the heap.
+// Number of blocks of each size. When all blocks that fit a message are in use, heap is used
+#ifndef ELOG_SLAB_BLOCKS_64
+#define ELOG_SLAB_BLOCKS_64 16
+#endif
+
+#ifndef ELOG_SLAB_BLOCKS_128
+#define ELOG_SLAB_BLOCKS_128 8
+#endif
+
+#ifndef ELOG_SLAB_BLOCKS_256
+#define ELOG_SLAB_BLOCKS_256 4
+#endif
+
+#ifndef ELOG_SLAB_BLOCKS_512
+#define ELOG_SLAB_BLOCKS_512 2
+#endif
+
+// Number of log ids whose last message is remembered at once when repeated messages are suppressed with
+// Logger.enableDedup(). Log ids share a slot when there are more of them
+#ifndef ELOG_DEDUP_SLOTS
+#define ELOG_DEDUP_SLOTS 16
+#endif
+
+// Most log id and level pairs that can be sampled with Logger.setSampling()
+#ifndef ELOG_SAMPLINGS_MAX
+#define ELOG_SAMPLINGS_MAX 8
+#endif
+
+// Most log ids that can be given a rate limit with Logger.setRateLimit()
+#ifndef ELOG_RATE_LIMITS_MAX
+#define ELOG_RATE_LIMITS_MAX 8
+#endif
+
+// How often the number of messages suppressed by a rate limit is logged
+#ifndef ELOG_RATE_LIMIT_NOTICE_MS
+#define ELOG_RATE_LIMIT_NOTICE_MS 10000
+#endif
+
+// Number of log lines in the priority lane enabled with Logger.enablePriorityLane(). Severe messages that
+// do not fit are added to the normal log buffer
+#ifndef ELOG_PRIORITY_LANE_LINES
+#define ELOG_PRIORITY_LANE_LINES 8
+#endif
+
 #endif // ELOG_CONFIG_H
@@ -0,0 +1,437 @@
+#include <LogArgs.h>
+#include <wchar.h>
+
+/* Encode the arguments of a printf style format string into a compact binary form
+ * Values that do not fit in output are not written, but are still counted in the returned size.
+ * The encoded values are always complete. A value is never split
+ * output: where to write the encoded arguments. Can be nullptr if outputSize is 0
+ * outputSize: the size of output in bytes
+ * format: the format string (like printf)
+ * args: the arguments for the format
+ * hash: if not nullptr, all encoded values are added to this hash (see hashBytes). Also those that do not fit output
+ * returns: the number of bytes needed to encode all arguments
+ */
+size_t LogArgs::encode(uint8_t* output, size_t outputSize, const char* format, va_list args, uint32_t* hash)
+{
+    size_t position = sizeof(uint16_t); // Room for the length of the encoded values
+    size_t written = position;
+
+    while (*format != '\0') {
+        if (*format != '%') {
+            format++;
+            continue;
+        }
+
+        Spec spec;
+        format = parseSpec(format, spec);
+
+        if (spec.widthArg) {
+            int width = va_arg(args, int);
+            put(output, outputSize, position, written, hash, &width, sizeof(width));
+        }
+        int precision = spec.precision;
+        if (spec.precisionArg) {
+            precision = va_arg(args, int);
+            put(output, outputSize, position, written, hash, &precision, sizeof(precision));
+        }
+
+        switch (spec.kind) {
+        case ARG_INT: {
+            int value = va_arg(args, int);
+            put(output, outputSize, position, written, hash, &value, sizeof(value));
+            break;
+        }
+        case ARG_LONG: {
+            long value = va_arg(args, long);
+            put(output, outputSize, position, written, hash, &value, sizeof(value));
+            break;
+        }
+        case ARG_LONG_LONG: {
+            long long value = va_arg(args, long long);
+            put(output, outputSize, position, written, hash, &value, sizeof(value));
+            break;
+        }
+        case ARG_INTMAX: {
+            intmax_t value = va_arg(args, intmax_t);
+            put(output, outputSize, position, written, hash, &value, sizeof(value));
+            break;
+        }
+        case ARG_SIZE: {
+            size_t value = va_arg(args, size_t);
+            put(output, outputSize, position, written, hash, &value, sizeof(value));
+            break;
+        }
+        case ARG_PTRDIFF: {
+            ptrdiff_t value = va_arg(args, ptrdiff_t);
+            put(output, outputSize, position, written, hash, &value, sizeof(value));
+            break;
+        }
+        case ARG_DOUBLE: {
+            double value = va_arg(args, double);
+            put(output, outputSize, position, written, hash, &value, sizeof(value));
+            break;
+        }
+        case ARG_LONG_DOUBLE: {
+            long double value = va_arg(args, long double);
+            put(output, outputSize, position, written, hash, &value, sizeof(value));
+            break;
+        }
+        case ARG_POINTER: {
+            void* value = va_arg(args, void*);
+            put(output, outputSize, position, written, hash, &value, sizeof(value));
+            break;
+        }
+        case ARG_STRING:
+            putString(output, outputSize, position, written, hash, va_arg(args, const char*), precision);
+            break;
+        case ARG_NONE:
+            if (spec.conversion == 's' && hash != nullptr) { // %ls is not encoded, but two messages must not look alike
+                const wchar_t* value = va_arg(args, const wchar_t*);
+                if (value != nullptr) {
+                    *hash = hashBytes(*hash, value, wcslen(value) * sizeof(wchar_t));
+                }
+            } else if (spec.conversion == 'n' || spec.conversion == 's') {
+                va_arg(args, void*); // %n and %ls. Skip the argument
+            }
+            break;
+        }
+    }
+
+    if (outputSize >= sizeof(uint16_t)) {
+        uint16_t encodedLength = written - sizeof(uint16_t);
+        memcpy(output, &encodedLength, sizeof(encodedLength));
+    }
+    return position;
+}
+
+/* Render a log message from a format string and arguments encoded with encode
+ * The result is the same as vsnprintf would give with the original arguments
+ * output: where to write the message
+ * outputSize: the size of output. The message is truncated if it is longer
+ * format: the same format string as given to encode
+ * encoded: the encoded arguments
+ * returns: the length of the rendered message
+ */
+size_t LogArgs::render(char* output, size_t outputSize, const char* format, const uint8_t* encoded)
+{
+    uint16_t encodedLength;
+    memcpy(&encodedLength, encoded, sizeof(encodedLength));
+    const uint8_t* arg = encoded + sizeof(encodedLength);
+    const uint8_t* end = arg + encodedLength;
+
+    size_t position = 0;
+    output[0] = '\0';
+
+    while (*format != '\0') {
+        if (*format != '%') {
+            const char* next = strchr(format, '%');
+            size_t length = next != nullptr ? next - format : strlen(format);
+            append(output, outputSize, position, format, length);
+            format += length;
+            continue;
+        }
+
+        Spec spec;
+        const char* specStart = format;
+        format = parseSpec(format, spec);
+
+        if (spec.conversion == '%') {
+            append(output, outputSize, position, "%", 1);
+            continue;
+        }
+
+        int stars[2];
+        uint8_t starCount = 0;
+        if (spec.widthArg && !get(arg, end, stars[starCount++])) {
+            break; // Arguments were truncated when encoded
+        }
+        if (spec.precisionArg && !get(arg, end, stars[starCount++])) {
+            break;
+        }
+
+        char specFormat[LENGTH_ARG_SPEC];
+        bool renderable = spec.length < sizeof(specFormat);
+        if (renderable) {
+            memcpy(specFormat, specStart, spec.length);
+            specFormat[spec.length] = '\0';
+        }
+
+        int length = 0;
+        bool complete = true;
+        switch (spec.kind) {
+        case ARG_INT: {
+            int value;
+            if ((complete = get(arg, end, value)) && renderable)
+                length = renderValue(output + position, outputSize - position, specFormat, starCount, stars, value);
+            break;
+        }
+        case ARG_LONG: {
+            long value;
+            if ((complete = get(arg, end, value)) && renderable)
+                length = renderValue(output + position, outputSize - position, specFormat, starCount, stars, value);
+            break;
+        }
+        case ARG_LONG_LONG: {
+            long long value;
+            if ((complete = get(arg, end, value)) && renderable)
+                length = renderValue(output + position, outputSize - position, specFormat, starCount, stars, value);
+            break;
+        }
+        case ARG_INTMAX: {
+            intmax_t value;
+            if ((complete = get(arg, end, value)) && renderable)
+                length = renderValue(output + position, outputSize - position, specFormat, starCount, stars, value);
+            break;
+        }
+        case ARG_SIZE: {
+            size_t value;
+            if ((complete = get(arg, end, value)) && renderable)
+                length = renderValue(output + position, outputSize - position, specFormat, starCount, stars, value);
+            break;
+        }
+        case ARG_PTRDIFF: {
+            ptrdiff_t value;
+            if ((complete = get(arg, end, value)) && renderable)
+                length = renderValue(output + position, outputSize - position, specFormat, starCount, stars, value);
+            break;
+        }
+        case ARG_DOUBLE: {
+            double value;
+            if ((complete = get(arg, end, value)) && renderable)
+                length = renderValue(output + position, outputSize - position, specFormat, starCount, stars, value);
+            break;
+        }
+        case ARG_LONG_DOUBLE: {
+            long double value;
+            if ((complete = get(arg, end, value)) && renderable)
+                length = renderValue(output + position, outputSize - position, specFormat, starCount, stars, value);
+            break;
+        }
+        case ARG_POINTER: {
+            void* value;
+            if ((complete = get(arg, end, value)) && renderable)
+                length = renderValue(output + position, outputSize - position, specFormat, starCount, stars, value);
+            break;
+        }
+        case ARG_STRING: {
+            const char* value = reinterpret_cast<const char*>(arg);
+            const void* terminator = memchr(arg, '\0', end - arg);
+            if ((complete = terminator != nullptr)) {
+                arg = reinterpret_cast<const uint8_t*>(terminator) + 1;
+                if (renderable)
+                    length = renderValue(output + position, outputSize - position, specFormat, starCount, stars, value);
+            }
+            break;
+        }
+        case ARG_NONE:
+            break;
+        }
+
+        if (!complete) {
+            break;
+        }
+        if (length > 0) {
+            position += length;
+            if (position >= outputSize) {
+                position = outputSize - 1; // Truncated
+            }
+        }
+    }
+    return position;
+}
+
+/* Parse one conversion specification (%[flags][width][.precision][length]conversion)
+ * format: points to the '%' starting the specification
+ * spec: the parsed specification
+ * returns: pointer to the first character after the specification
+ */
+const char* LogArgs::parseSpec(const char* format, Spec& spec)
+{
+    const char* p = format + 1;
+    spec.widthArg = false;
+    spec.precisionArg = false;
+    spec.precision = -1;
+    spec.kind = ARG_NONE;
+
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') { // flags
+        p++;
+    }
+    if (*p == '*') { // width
+        spec.widthArg = true;
+        p++;
+    } else {
+        while (isdigit(*p)) {
+            p++;
+        }
+    }
+    if (*p == '.') { // precision
+        p++;
+        if (*p == '*') {
+            spec.precisionArg = true;
+            p++;
+        } else {
+            spec.precision = 0;
+            while (isdigit(*p)) {
+                spec.precision = spec.precision * 10 + (*p - '0');
+                p++;
+            }
+        }
+    }
+
+    ArgKind integerKind = ARG_INT; // length modifier
+    bool longDouble = false;
+    bool wide = false;
+    if (*p == 'h') {
+        p += p[1] == 'h' ? 2 : 1; // char and short are promoted to int
+    } else if (*p == 'l') {
+        wide = true;
+        if (p[1] == 'l') {
+            integerKind = ARG_LONG_LONG;
+            p += 2;
+        } else {
+            integerKind = ARG_LONG;
+            p++;
+        }
+    } else if (*p == 'j') {
+        integerKind = ARG_INTMAX;
+        p++;
+    } else if (*p == 'z') {
+        integerKind = ARG_SIZE;
+        p++;
+    } else if (*p == 't') {
+        integerKind = ARG_PTRDIFF;
+        p++;
+    } else if (*p == 'L') {
+        longDouble = true;
+        p++;
+    }
+
+    spec.conversion = *p;
+    switch (*p) {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+        spec.kind = integerKind;
+        break;
+    case 'c':
+        spec.kind = ARG_INT;
+        break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        spec.kind = longDouble ? ARG_LONG_DOUBLE : ARG_DOUBLE;
+        break;
+    case 's':
+        spec.kind = wide ? ARG_NONE : ARG_STRING;
+        break;
+    case 'p':
+        spec.kind = ARG_POINTER;
+        break;
+    }
+    if (*p != '\0') {
+        p++;
+    }
+
+    spec.length = p - format > UINT8_MAX ? UINT8_MAX : p - format;
+    return p;
+}
+
+/* Returns an FNV-1a hash of data. A hash can be fed in pieces, by passing the result of one call to the next
+ * hash: LOG_HASH_BASIS for the first piece, else the hash of the pieces before
+ * data: the bytes to add
+ * length: the number of bytes
+ */
+uint32_t LogArgs::hashBytes(uint32_t hash, const void* data, size_t length)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619UL;
+    }
+    return hash;
+}
+
+/* Write a value to the encoded arguments if it fits
+ * Once a value did not fit, nothing more is written so the encoded values are never misaligned
+ * position: where the value belongs. Always advanced
+ * written: how much has been written. Only advanced if the value fits
+ * hash: if not nullptr, the value is added to it, even if it does not fit
+ */
+void LogArgs::put(uint8_t* output, size_t outputSize, size_t& position, size_t& written, uint32_t* hash, const void* value, size_t length)
+{
+    if (hash != nullptr) {
+        *hash = hashBytes(*hash, value, length);
+    }
+    if (written == position && position + length <= outputSize) {
+        memcpy(output + position, value, length);
+        written += length;
+    }
+    position += length;
+}
+
+/* Write a string including null terminator to the encoded arguments if it fits
+ * With a precision only that many characters are copied, as the string does not need to be null terminated
+ */
+void LogArgs::putString(uint8_t* output, size_t outputSize, size_t& position, size_t& written, uint32_t* hash, const char* value, int precision)
+{
+    if (value == nullptr) {
+        value = "(null)";
+    }
+    size_t length = precision >= 0 ? strnlen(value, precision) : strlen(value);
+    if (hash != nullptr) {
+        *hash = hashBytes(*hash, value, length + 1); // With the terminator, so "ab" "c" differs from "a" "bc"
+    }
+
+    if (written == position && position + length + 1 <= outputSize) {
+        memcpy(output + position, value, length);
+        output[position + length] = '\0';
+        written += length + 1;
+    }
+    position += length + 1;
+}
+
+/* Append text to the rendered message. It is truncated if there is no room for all of it */
+void LogArgs::append(char* output, size_t outputSize, size_t& position, const char* text, size_t length)
+{
+    if (position + length >= outputSize) {
+        length = outputSize - position - 1;
+    }
+    memcpy(output + position, text, length);
+    position += length;
+    output[position] = '\0';
+}
+
+/* Read a value from the encoded arguments
+ * returns: false if the value was not encoded (the arguments were truncated)
+ */
+template <typename V>
+bool LogArgs::get(const uint8_t*& arg, const uint8_t* end, V& value)
+{
+    if (arg + sizeof(V) > end) {
+        return false;
+    }
+    memcpy(&value, arg, sizeof(V));
+    arg += sizeof(V);
+    return true;
+}
+
+/* Render a single value with its conversion specification. Width and precision given as arguments are passed in stars */
+template <typename V>
+int LogArgs::renderValue(char* output, size_t outputSize, const char* specFormat, uint8_t starCount, const int* stars, V value)
+{
+    switch (starCount) {
+    case 0:
+        return snprintf(output, outputSize, specFormat, value);
+    case 1:
+        return snprintf(output, outputSize, specFormat, stars[0], value);
+    default:
+        return snprintf(output, outputSize, specFormat, stars[0], stars[1], value);
+    }
+}
@@ -0,0 +1,313 @@
+#ifndef ELOG_LOGARGS_H
+#define ELOG_LOGARGS_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <type_traits>
+
+#define LENGTH_ARG_SPEC 24 // Longest conversion specification (like "%-08.3lld") that can be rendered
+#define LOG_HASH_BASIS 2166136261UL // Start value of a hash made with LogArgs::hashBytes
+
+/* LogArgs is used for deferred formatting. Instead of formatting a log message when it is logged, the arguments
+ * are encoded in a compact binary form. The message is then rendered later by the writer task using the same
+ * format string.
+ *
+ * Encoded arguments start with a 16 bit length of the values that follows. Each value is stored raw in the order
+ * of the format string. Strings (%s) are copied including their null terminator. Wide strings (%ls) and %n are
+ * not supported and are rendered as nothing.
+ *
+ * Arguments can be encoded in two ways giving the same result. encode parses the format string at runtime to
+ * find the types in a va_list. encodeValues uses the C++ types of the arguments known at compile time
+ * (see LogArgType below), so the format string is not touched at all.
+ */
+template <typename T, typename Enable>
+struct LogArgType;
+template <typename Encoded, char typeCode>
+struct LogArgFixed;
+
+class LogArgs {
+    enum ArgKind {
+        ARG_NONE,
+        ARG_INT,
+        ARG_LONG,
+        ARG_LONG_LONG,
+        ARG_INTMAX,
+        ARG_SIZE,
+        ARG_PTRDIFF,
+        ARG_DOUBLE,
+        ARG_LONG_DOUBLE,
+        ARG_POINTER,
+        ARG_STRING
+    };
+
+    struct Spec {
+        uint8_t length; // Length of the conversion specification including '%'
+        bool widthArg; // Width is given as an argument (*)
+        bool precisionArg; // Precision is given as an argument (.*)
+        int precision; // Precision given in the format string. -1 if none
+        char conversion; // The conversion character (d, s, f, ...)
+        ArgKind kind;
+    };
+
+    template <typename T, typename Enable>
+    friend struct LogArgType;
+    template <typename Encoded, char typeCode>
+    friend struct LogArgFixed;
+
+public:
+    static size_t encode(uint8_t* output, size_t outputSize, const char* format, va_list args, uint32_t* hash = nullptr);
+    static size_t render(char* output, size_t outputSize, const char* format, const uint8_t* encoded);
+
+    template <typename... Args>
+    static size_t encodedSize(const Args&... args);
+    template <typename... Args>
+    static size_t encodeValues(uint8_t* output, size_t outputSize, const Args&... args);
+    template <typename... Args>
+    static uint32_t hashValues(uint32_t hash, const Args&... args);
+    template <typename... Args>
+    static bool formatMatches(const char* format);
+    static uint32_t hashBytes(uint32_t hash, const void* data, size_t length);
+
+    /* Compile time check of a format string against the type codes of its arguments (see LogArgTypes)
+     * Width and precision given as arguments (*) must be int. Integers of the same size are accepted for each other.
+     * %n, %ls and unknown conversions fail the check
+     */
+    static constexpr bool checkFormat(const char* format, const char* types)
+    {
+        return *format == '\0' ? *types == '\0'
+            : *format != '%'   ? checkFormat(format + 1, types)
+            : format[1] == '%' ? checkFormat(format + 2, types)
+                               : checkWidth(skipFlags(format + 1), types);
+    }
+
+private:
+    static constexpr const char* skipFlags(const char* format)
+    {
+        return *format == '-' || *format == '+' || *format == ' ' || *format == '#' || *format == '0' ? skipFlags(format + 1) : format;
+    }
+
+    static constexpr const char* skipDigits(const char* format)
+    {
+        return *format >= '0' && *format <= '9' ? skipDigits(format + 1) : format;
+    }
+
+    static constexpr bool checkWidth(const char* format, const char* types)
+    {
+        return *format == '*' ? *types == 'i' && checkPrecision(format + 1, types + 1) : checkPrecision(skipDigits(format), types);
+    }
+
+    static constexpr bool checkPrecision(const char* format, const char* types)
+    {
+        return *format != '.' ? checkConversion(format, types)
+            : format[1] == '*' ? *types == 'i' && checkConversion(format + 2, types + 1)
+                               : checkConversion(skipDigits(format + 1), types);
+    }
+
+    static constexpr bool checkConversion(const char* format, const char* types)
+    {
+        return *types != '\0' && typeMatches(expectedType(format, format[modifierLength(format)]), *types)
+            && checkFormat(format + modifierLength(format) + 1, types + 1);
+    }
+
+    static constexpr uint8_t modifierLength(const char* format)
+    {
+        return *format == 'h' || *format == 'l' ? (format[1] == *format ? 2 : 1)
+            : *format == 'j' || *format == 'z' || *format == 't' || *format == 'L' ? 1
+                                                                                   : 0;
+    }
+
+    /* The type code a conversion expects. format points to the length modifier, conversion is the conversion character */
+    static constexpr char expectedType(const char* format, char conversion)
+    {
+        return conversion == 'd' || conversion == 'i' || conversion == 'u' || conversion == 'o' || conversion == 'x' || conversion == 'X' ? integerType(format)
+            : conversion == 'c' ? 'i'
+            : conversion == 'f' || conversion == 'F' || conversion == 'e' || conversion == 'E' || conversion == 'g' || conversion == 'G' || conversion == 'a' || conversion == 'A' ? (*format == 'L' ? 'D' : 'd')
+            : conversion == 's' && *format != 'l' ? 's'
+            : conversion == 'p' ? 'p'
+                                : '?';
+    }
+
+    static constexpr char integerType(const char* format)
+    {
+        return *format == 'l' ? (format[1] == 'l' ? 'L' : 'l')
+            : *format == 'j'  ? 'j'
+            : *format == 'z'  ? 'z'
+            : *format == 't'  ? 't'
+                              : 'i';
+    }
+
+    static constexpr size_t integerSize(char type)
+    {
+        return type == 'i' ? sizeof(int)
+            : type == 'l'  ? sizeof(long)
+            : type == 'L'  ? sizeof(long long)
+            : type == 'j'  ? sizeof(intmax_t)
+            : type == 'z'  ? sizeof(size_t)
+            : type == 't'  ? sizeof(ptrdiff_t)
+                           : 0;
+    }
+
+    static constexpr bool typeMatches(char expected, char actual)
+    {
+        return expected == actual || (integerSize(expected) != 0 && integerSize(expected) == integerSize(actual));
+    }
+
+    static void putValues(uint8_t* output, size_t outputSize, size_t& position, size_t& written, uint32_t* hash) { }
+    template <typename V, typename... Rest>
+    static void putValues(uint8_t* output, size_t outputSize, size_t& position, size_t& written, uint32_t* hash, const V& value, const Rest&... rest);
+
+    static const char* parseSpec(const char* format, Spec& spec);
+    static void put(uint8_t* output, size_t outputSize, size_t& position, size_t& written, uint32_t* hash, const void* value, size_t length);
+    static void putString(uint8_t* output, size_t outputSize, size_t& position, size_t& written, uint32_t* hash, const char* value, int precision);
+    static void append(char* output, size_t outputSize, size_t& position, const char* text, size_t length);
+
+    template <typename V>
+    static bool get(const uint8_t*& arg, const uint8_t* end, V& value);
+    template <typename V>
+    static int renderValue(char* output, size_t outputSize, const char* specFormat, uint8_t starCount, const int* stars, V value);
+};
+
+/* LogArgType describes how an argument of type T is encoded by LogArgs::encodeValues. code is the type code used by
+ * LogArgs::checkFormat. Types without a LogArgType (like String) can not be logged and fail to compile
+ */
+template <typename T, typename Enable = void>
+struct LogArgType;
+
+// Arguments of a fixed size. Stored as the type they would be promoted to when passed to printf
+template <typename Encoded, char typeCode>
+struct LogArgFixed {
+    static constexpr char code = typeCode;
+
+    template <typename T>
+    static size_t size(const T& value) { return sizeof(Encoded); }
+
+    template <typename T>
+    static void put(uint8_t* output, size_t outputSize, size_t& position, size_t& written, uint32_t* hash, const T& value)
+    {
+        Encoded encoded = (Encoded)value;
+        LogArgs::put(output, outputSize, position, written, hash, &encoded, sizeof(encoded));
+    }
+};
+
+template <typename T>
+struct LogArgType<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type>
+    : LogArgFixed<typename std::conditional<sizeof(T) <= sizeof(int), int, typename std::conditional<sizeof(T) <= sizeof(long), long, long long>::type>::type,
+          sizeof(T) <= sizeof(int) ? 'i' : sizeof(T) <= sizeof(long) ? 'l' : 'L'> { };
+
+template <typename T>
+struct LogArgType<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+    : LogArgFixed<typename std::conditional<(sizeof(T) > sizeof(double)), long double, double>::type, (sizeof(T) > sizeof(double)) ? 'D' : 'd'> { };
+
+/* Pointers to characters are strings. Like with printf, signed and unsigned characters and flash strings (F("...")) can be
+ * logged with %s too. Any other pointer can only be logged with %p
+ */
+template <typename T>
+struct LogArgIsString {
+    typedef typename std::remove_cv<typename std::remove_pointer<T>::type>::type Pointee;
+    static constexpr bool value = std::is_pointer<T>::value
+        && (std::is_same<Pointee, char>::value || std::is_same<Pointee, signed char>::value || std::is_same<Pointee, unsigned char>::value
+            || std::is_same<Pointee, __FlashStringHelper>::value);
+};
+
+template <typename T>
+struct LogArgType<T, typename std::enable_if<std::is_pointer<T>::value && !LogArgIsString<T>::value>::type>
+    : LogArgFixed<const void*, 'p'> { };
+
+template <>
+struct LogArgType<std::nullptr_t> : LogArgFixed<const void*, 'p'> { };
+
+// Strings are copied including null terminator
+template <typename T>
+struct LogArgType<T, typename std::enable_if<LogArgIsString<T>::value>::type> {
+    static constexpr char code = 's';
+
+    static size_t size(const T& value) { return (value != nullptr ? strlen((const char*)value) : 6) + 1; }
+
+    static void put(uint8_t* output, size_t outputSize, size_t& position, size_t& written, uint32_t* hash, const T& value)
+    {
+        LogArgs::putString(output, outputSize, position, written, hash, (const char*)value, -1);
+    }
+};
+
+/* Argument type descriptor. codes holds the type code of each argument in order */
+template <typename... Args>
+struct LogArgTypes {
+    static constexpr char codes[sizeof...(Args) + 1] = { LogArgType<Args>::code..., '\0' };
+};
+
+template <typename... Args>
+constexpr char LogArgTypes<Args...>::codes[sizeof...(Args) + 1];
+
+/* Only used with decltype to get the argument type descriptor of a list of arguments */
+template <typename... Args>
+LogArgTypes<typename std::decay<Args>::type...> logArgTypesOf(const Args&... args);
+
+/* Returns the number of bytes encodeValues needs for args. Only strings add to the size at runtime */
+template <typename... Args>
+size_t LogArgs::encodedSize(const Args&... args)
+{
+    size_t sizes[] = { sizeof(uint16_t), LogArgType<Args>::size(args)... };
+    size_t size = 0;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size += sizes[i];
+    }
+    return size;
+}
+
+/* Encode arguments using their compile time types. Gives the same result as encode with a matching format string
+ * output: where to write the encoded arguments
+ * outputSize: the size of output in bytes. Values that do not fit are not written
+ * returns: the number of bytes needed to encode all arguments
+ */
+template <typename... Args>
+size_t LogArgs::encodeValues(uint8_t* output, size_t outputSize, const Args&... args)
+{
+    size_t position = sizeof(uint16_t); // Room for the length of the encoded values
+    size_t written = position;
+    putValues(output, outputSize, position, written, nullptr, args...);
+
+    if (outputSize >= sizeof(uint16_t)) {
+        uint16_t encodedLength = written - sizeof(uint16_t);
+        memcpy(output, &encodedLength, sizeof(encodedLength));
+    }
+    return position;
+}
+
+/* Runtime check of a format string against the types of Args, for formats that are not known at compile time.
+ * The last format that matched is remembered for each list of types, so a log call checks its format only once
+ * returns: true if the arguments can be encoded with encodeValues. Otherwise encode must be used
+ */
+template <typename... Args>
+bool LogArgs::formatMatches(const char* format)
+{
+    static std::atomic<const char*> matched { nullptr };
+    if (matched.load(std::memory_order_relaxed) == format) {
+        return true;
+    }
+    if (!checkFormat(format, LogArgTypes<Args...>::codes)) {
+        return false;
+    }
+    matched.store(format, std::memory_order_relaxed);
+    return true;
+}
+
+/* Returns hash with the values of args added, as encodeValues would encode them (see hashBytes). Nothing is written
+ * hash: the hash to add to
+ */
+template <typename... Args>
+uint32_t LogArgs::hashValues(uint32_t hash, const Args&... args)
+{
+    size_t position = 0;
+    size_t written = 0;
+    putValues(nullptr, 0, position, written, &hash, args...);
+    return hash;
+}
+
+template <typename V, typename... Rest>
+void LogArgs::putValues(uint8_t* output, size_t outputSize, size_t& position, size_t& written, uint32_t* hash, const V& value, const Rest&... rest)
+{
+    LogArgType<V>::put(output, outputSize, position, written, hash, value);
+    putValues(output, outputSize, position, written, hash, rest...);
+}
+
+#endif // ELOG_LOGARGS_H
@@ -20,15 +20,34 @@
 #undef FILE_WRITE
 #endif
 
-struct LogLineEntry {
-    uint32_t timestamp;
+#define LOG_LINE_ENTRY_SIZE ELOG_LINE_ENTRY_SIZE // Size of a log line entry in a line buffer. With its slot sequence one cache line
+#define WRITER_BATCH_SIZE 16 // Most log lines handed to the output devices at once
+
+enum LogLineFlags {
+    LOG_LINE_INLINE = 0x01, // The message is stored in inlineMessage. logMessage must be pointed there after the entry is copied
+    LOG_LINE_SYNCHRONOUS = 0x02 // The message is written to the serial ports by the task that logs it. The writer task skips them
+};
+
+struct LogLineHeader {
+    uint64_t timestamp; // Microseconds since boot (esp_timer_get_time). Does not wrap like millis() does after 49 days
+    uint32_t sequence; // Strict order of messages logged in the same microsecond, or on different cores. See ELOG_FLAG_SEQUENCE
+    const char* logMessage;
+    const char* format; // Set if formatting is deferred. logMessage then holds the encoded arguments (see LogArgs.h)
     uint8_t logId;
     uint8_t logLevel;
-    uint8_t lastMsgLogLevel;
-    Stream* internalLogDevice;
-    const char* logMessage;
+    uint8_t flags; // LogLineFlags
+    uint8_t batchIndex; // Position of the line in the batch of the writer task. Set by the writer task only
 };
 
+// Short messages are stored in the entry itself, so they need no heap memory. Longer ones are stored on heap.
+// A byte budgeted buffer stores only the header, as the message always follows it in the arena
+struct LogLineEntry : LogLineHeader {
+    char inlineMessage[LOG_LINE_ENTRY_SIZE - sizeof(LogLineHeader)];
+};
+
+static_assert(LOG_LINE_ENTRY_SIZE > sizeof(LogLineHeader) && LOG_LINE_ENTRY_SIZE % 8 == 0, "ELOG_LINE_ENTRY_SIZE must be a multiple of 8 and larger than the entry header");
+static_assert(sizeof(LogLineEntry) == LOG_LINE_ENTRY_SIZE, "LogLineEntry must be exactly LOG_LINE_ENTRY_SIZE bytes");
+
 enum LogFlags {
     ELOG_FLAG_NONE = 0x00,
     ELOG_FLAG_NO_TIME = 0x01,
@@ -37,7 +56,8 @@ enum LogFlags {
     ELOG_FLAG_TIME_SIMPLE = 0x08,
     ELOG_FLAG_TIME_SHORT = 0x10,
     ELOG_FLAG_TIME_LONG = 0x20,
-    ELOG_FLAG_SERVICE_LONG = 0x40
+    ELOG_FLAG_SERVICE_LONG = 0x40,
+    ELOG_FLAG_SEQUENCE = 0x80
 };
 
 // Don't forget to update logLevelStrings in LogFormat.cpp
@@ -58,6 +78,14 @@ enum LogLevel {
     ELOG_NUM_LOG_LEVELS = ELOG_LEVEL_NOLOG
 };
 
+// What to do with a log message when the log buffer is full. See Elog::configure
+enum LogOverflowPolicy {
+    ELOG_OVERFLOW_DROP_NEWEST = 0, // Discard the new message
+    ELOG_OVERFLOW_BLOCK = 1, // Wait for space. The wait can be limited with Elog::setBufferFullTimeout
+    ELOG_OVERFLOW_DROP_OLDEST = 2, // Discard the oldest buffered messages to make room. Line buffer only
+    ELOG_OVERFLOW_DROP_LOWEST_LEVEL = 3 // Discard the least severe messages first. The last part of the buffer is kept for severe messages
+};
+
 enum LogFacility {
     ELOG_FAC_KERN = 0,
     ELOG_FAC_USER = 1,
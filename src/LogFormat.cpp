@@ -1,104 +1,642 @@
 #include <LogFormat.h>
+#include <esp_timer.h>
+
+// Digit pairs "00" to "99". Numbers are written two digits at a time from this table instead of with sprintf,
+// which costs hundreds of cycles per field on the ESP32. Divisions are by constants, so the compiler makes them multiplications
+static const char twoDigits[201] = "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+                                   "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+/* Write a number below 100 as two digits
+ * output: where to write
+ * value: the number
+ * returns: the position after the digits
+ */
+static inline char* putTwoDigits(char* output, const uint32_t value)
+{
+    memcpy(output, &twoDigits[value * 2], 2);
+    return output + 2;
+}
+
+/* Write a number below 1000 as three digits
+ * output: where to write
+ * value: the number
+ * returns: the position after the digits
+ */
+static inline char* putThreeDigits(char* output, const uint32_t value)
+{
+    *output = '0' + value / 100;
+    return putTwoDigits(output + 1, value % 100);
+}
+
+/* Write a number in decimal, padded with zeros to at least minDigits digits (like "%0*u")
+ * output: where to write
+ * value: the number
+ * minDigits: the least number of digits written. At most 10
+ * returns: the position after the digits
+ */
+static char* putUnsigned(char* output, uint32_t value, const uint8_t minDigits)
+{
+    char digits[10];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+
+    while (value >= 100) {
+        start -= 2;
+        memcpy(start, &twoDigits[(value % 100) * 2], 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        start -= 2;
+        memcpy(start, &twoDigits[value * 2], 2);
+    } else {
+        *--start = '0' + value;
+    }
+    while (end - start < minDigits) {
+        *--start = '0';
+    }
+    memcpy(output, start, end - start);
+    return output + (end - start);
+}
+
+/* Write a 64 bit number in decimal, padded with zeros to at least minDigits digits (like "%0*llu").
+ * Numbers that fit 32 bits, which is nearly all of them, are written without 64 bit divisions
+ * output: where to write
+ * value: the number
+ * minDigits: the least number of digits written. At most 10
+ * returns: the position after the digits
+ */
+static char* putUnsigned64(char* output, const uint64_t value, const uint8_t minDigits)
+{
+    if (value <= UINT32_MAX) {
+        return putUnsigned(output, value, minDigits);
+    }
+    output = putUnsigned(output, value / 1000000000, minDigits > 9 ? minDigits - 9 : 1);
+    return putUnsigned(output, value % 1000000000, 9);
+}
+
+static const char* logLevelStrings[ELOG_NUM_LOG_LEVELS] = { "ALWAY", "EMERG", "ALERT", "CRIT", "ERROR", "WARN", "NOTIC", "INFO", "DEBUG", "TRACE", "VERBO" };
+
+// "[LEVEL] " for each log level, padded to the same width
+static const char logLevelTags[ELOG_NUM_LOG_LEVELS][LENGTH_OF_LEVEL] = { "[ALWAY] ", "[EMERG] ", "[ALERT] ", "[CRIT ] ", "[ERROR] ",
+    "[WARN ] ", "[NOTIC] ", "[INFO ] ", "[DEBUG] ", "[TRACE] ", "[VERBO] " };
+
+/* Work out once how a registration stamps its lines, so writing a stamp needs no tests of the flags.
+ * The service tag is rendered here, and the time format is chosen as a function
+ * plan: the plan to fill
+ * serviceName: the name of the service
+ * logFlags: the flags of the registration
+ */
+void Formatting::compileStampPlan(LogStampPlan& plan, const char* serviceName, const uint8_t logFlags)
+{
+    memset(&plan, 0, sizeof(plan)); // Plans are compared with memcmp by getLogStampCached
+
+    if (logFlags & ELOG_FLAG_NO_TIME)
+        plan.putTime = putTimeNone;
+    else if (logFlags & ELOG_FLAG_TIME_SIMPLE)
+        plan.putTime = putTimeSimple;
+    else if (logFlags & ELOG_FLAG_TIME_LONG)
+        plan.putTime = putTimeLong;
+    else if (logFlags & ELOG_FLAG_TIME_SHORT)
+        plan.putTime = putTimeShort;
+    else // default to long time
+        plan.putTime = putTimeLong;
+
+    plan.sequence = logFlags & ELOG_FLAG_SEQUENCE;
+    if (!(logFlags & ELOG_FLAG_NO_SERVICE)) {
+        getServiceString(plan.serviceTag, serviceName, logFlags & ELOG_FLAG_SERVICE_LONG);
+        plan.serviceTagLength = strlen(plan.serviceTag);
+    }
+    plan.levelTagLength = logFlags & ELOG_FLAG_NO_LEVEL ? 0 : LENGTH_OF_LEVEL - 1;
+}
 
 /* Get the log stamp for the log line. The format is [TIME][SERVIC][LOGLEVEL]. It can be customized with flags
- * logTime: the time of the log
- * logLevel: the log level
+ * output: the output string
+ * logLine: the log line
+ * plan: the stamp plan of the registration (see compileStampPlan)
+ * returns: the length of the stamp
+ */
+size_t Formatting::getLogStamp(char* output, const LogLineHeader& logLine, const LogStampPlan& plan)
+{
+    const LogPattern* pattern = __atomic_load_n(&plan.pattern, __ATOMIC_ACQUIRE); // May be set by another task
+    if (pattern != nullptr) {
+        return putLogPattern(output, logLine, *pattern);
+    }
+
+    char* position = plan.putTime(output, logLine.timestamp);
+    if (plan.sequence) {
+        *position++ = '#';
+        position = putUnsigned(position, logLine.sequence, 1);
+        *position++ = ' ';
+    }
+    memcpy(position, plan.serviceTag, plan.serviceTagLength);
+    position += plan.serviceTagLength;
+    memcpy(position, logLevelTags[logLine.logLevel], plan.levelTagLength);
+    position += plan.levelTagLength;
+    *position = '\0';
+    return position - output;
+}
+
+/* Get the log stamp for a log line of a registration without a stamp plan
+ * output: the output string
+ * logLine: the log line
  * serviceName: the name of the service
  * logFlags: the flags for the log
- * output: the output string
  */
-void Formatting::getLogStamp(char* output, const uint32_t logTime, const uint8_t logLevel, const char* serviceName, const uint8_t logFlags)
+void Formatting::getLogStamp(char* output, const LogLineHeader& logLine, const char* serviceName, const uint8_t logFlags)
 {
-    char timeStr[LENGTH_OF_TIME] = { 0 };
-    char logServiceStr[LENGTH_OF_SERVICE] = { 0 };
-    char logLevelStr[LENGTH_OF_LEVEL] = { 0 };
+    LogStampPlan plan;
+    compileStampPlan(plan, serviceName, logFlags);
+    getLogStamp(output, logLine, plan);
+}
 
-    if (!(logFlags & ELOG_FLAG_NO_TIME)) {
-        if (logFlags & ELOG_FLAG_TIME_SIMPLE)
-            getSimpleTimeString(timeStr, logTime);
-        else if (logFlags & ELOG_FLAG_TIME_LONG)
-            getTimeLongString(timeStr, logTime);
-        else if (logFlags & ELOG_FLAG_TIME_SHORT)
-            getTimeMillisString(timeStr, logTime, true);
-        else // default to long time
-            getTimeLongString(timeStr, logTime);
+/* Pad a field written at start with spaces to the width of the op, or cut it to the precision of the op
+ * start: where the field starts
+ * end: where the field ends
+ * op: the pattern op of the field
+ * returns: the position after the field
+ */
+static char* fitField(char* start, char* end, const LogPattern::Op& op)
+{
+    size_t length = end - start;
+    if (op.precision != 0 && length > op.precision) {
+        length = op.precision;
+    }
+    if (length >= op.width) {
+        return start + length;
     }
 
-    if (!(logFlags & ELOG_FLAG_NO_SERVICE)) {
-        getServiceString(logServiceStr, serviceName, logFlags & ELOG_FLAG_SERVICE_LONG);
+    size_t padding = op.width - length;
+    if (op.leftAlign) {
+        memset(start + length, ' ', padding);
+    } else {
+        memmove(start + padding, start, length);
+        memset(start, ' ', padding);
+    }
+    return start + op.width;
+}
+
+/* Add fixed text to a pattern being compiled. Text following other text is merged into the same op
+ * pattern: the pattern being compiled
+ * text: the text
+ * length: the length of the text
+ * returns: false if the pattern has no room left
+ */
+static bool addPatternText(LogPattern& pattern, const char* text, size_t length)
+{
+    size_t textUsed = 0;
+    LogPattern::Op* last = nullptr;
+    for (uint8_t i = 0; i < pattern.opCount; i++) {
+        if (pattern.ops[i].type == LogPattern::OP_TEXT) {
+            textUsed = pattern.ops[i].textOffset + pattern.ops[i].textLength;
+        }
+    }
+    if (pattern.opCount > 0 && pattern.ops[pattern.opCount - 1].type == LogPattern::OP_TEXT) {
+        last = &pattern.ops[pattern.opCount - 1];
     }
 
-    if (!(logFlags & ELOG_FLAG_NO_LEVEL)) {
-        getLogLevelString(logLevelStr, logLevel);
+    if (textUsed + length > LENGTH_OF_PATTERN_TEXT) {
+        return false;
+    }
+    if (last == nullptr) {
+        if (pattern.opCount >= LOG_PATTERN_OPS_MAX) {
+            return false;
+        }
+        last = &pattern.ops[pattern.opCount++];
+        last->type = LogPattern::OP_TEXT;
+        last->textOffset = textUsed;
     }
-    strcpy(output, timeStr);
-    strcat(output, logServiceStr);
-    strcat(output, logLevelStr);
+    memcpy(pattern.text + textUsed, text, length);
+    last->textLength += length;
+    return true;
+}
+
+/* Parse a log pattern once, so writing a stamp with it needs no parsing. The pattern is text with fields
+ * in the form %[-][width][.precision]X, where X is
+ *   T  time like ELOG_FLAG_TIME_LONG: YYYY-MM-DD HH:MM:SS.mmm with real time, ddd:HH:MM:SS.mmm without
+ *   t  time like ELOG_FLAG_TIME_SHORT: HH:MM:SS
+ *   M  milliseconds since boot like ELOG_FLAG_TIME_SIMPLE
+ *   L  log level, like ERROR
+ *   S  service name as registered. Rendered here, as it does not change
+ *   n  sequence number of the log line
+ *   m  the message. Only allowed at the end, as the message is always written after the stamp.
+ *      Without %m the message follows the pattern anyway
+ *   %  a % sign
+ * Width pads a field with spaces, on the left unless - is given. Precision cuts it, like "%.3S" for [SER].
+ * The plan is only changed when the pattern is valid. Other tasks may be writing with the plan at the same time,
+ * so the pattern is built complete and then published. A plan gets a pattern only once. The pattern is then read
+ * without any lock, so it could never be freed safely if it was replaced
+ * plan: the stamp plan of the registration
+ * serviceName: the name of the service
+ * pattern: the pattern, like "%T %-5L %S: %m"
+ * returns: false if the pattern is not valid, too long to fit in LENGTH_OF_LOG_STAMP, or the plan has a pattern already
+ */
+bool Formatting::compileLogPattern(LogStampPlan& plan, const char* serviceName, const char* pattern)
+{
+    LogPattern compiled;
+    memset(&compiled, 0, sizeof(compiled));
+    size_t maxLength = 0; // Room the stamp may need. Time fields are rendered in full before they are cut
+
+    for (const char* position = pattern; *position != '\0'; position++) {
+        if (*position != '%' || position[1] == '%') {
+            if (!addPatternText(compiled, position, 1)) {
+                return false;
+            }
+            maxLength++;
+            position += *position == '%' ? 1 : 0;
+            continue;
+        }
+
+        LogPattern::Op op;
+        memset(&op, 0, sizeof(op));
+        uint16_t width = 0;
+        uint16_t precision = 0;
+        position++;
+        if (*position == '-') {
+            op.leftAlign = true;
+            position++;
+        }
+        while (isdigit(*position) && width < LENGTH_OF_LOG_STAMP) {
+            width = width * 10 + *position++ - '0';
+        }
+        if (*position == '.') {
+            position++;
+            while (isdigit(*position) && precision < LENGTH_OF_LOG_STAMP) {
+                precision = precision * 10 + *position++ - '0';
+            }
+        }
+        if (width >= LENGTH_OF_LOG_STAMP || precision >= LENGTH_OF_LOG_STAMP) {
+            return false;
+        }
+        op.width = width;
+        op.precision = precision;
+
+        size_t fieldLength; // The longest the field can be before it is padded or cut
+        switch (*position) {
+        case 'T':
+            op.type = LogPattern::OP_TIME_LONG;
+            fieldLength = LENGTH_OF_TIME;
+            break;
+        case 't':
+            op.type = LogPattern::OP_TIME_SHORT;
+            fieldLength = LENGTH_OF_TIME;
+            break;
+        case 'M':
+            op.type = LogPattern::OP_TIME_SIMPLE;
+            fieldLength = LENGTH_OF_TIME;
+            break;
+        case 'L':
+            op.type = LogPattern::OP_LEVEL;
+            fieldLength = LENGTH_OF_LEVEL - 4; // Without "[", "] " and the null terminator
+            break;
+        case 'n':
+            op.type = LogPattern::OP_SEQUENCE;
+            fieldLength = LENGTH_OF_SEQUENCE - 2; // Without "#" and " "
+            compiled.sequence = true;
+            break;
+        case 'S': {
+            char field[LENGTH_OF_LOG_STAMP];
+            size_t nameLength = strnlen(serviceName, sizeof(field) - 1);
+            memcpy(field, serviceName, nameLength);
+            size_t length = fitField(field, field + nameLength, op) - field;
+            if (!addPatternText(compiled, field, length)) {
+                return false;
+            }
+            maxLength += length;
+            continue;
+        }
+        case 'm':
+            if (position[1] != '\0') {
+                return false;
+            }
+            continue;
+        default: // Unknown field, or a % at the end
+            return false;
+        }
+
+        if (compiled.opCount >= LOG_PATTERN_OPS_MAX) {
+            return false;
+        }
+        compiled.ops[compiled.opCount++] = op;
+        maxLength += op.width > fieldLength ? op.width : fieldLength;
+    }
+
+    if (maxLength > LENGTH_OF_LOG_STAMP - 1) {
+        return false;
+    }
+
+    LogPattern* published = new LogPattern(compiled);
+    LogPattern* none = nullptr;
+    if (!__atomic_compare_exchange_n(&plan.pattern, &none, published, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) { // pairs with the load in getLogStamp
+        delete published; // Another task set a pattern first
+        return false;
+    }
+    return true;
+}
+
+/* Write the log stamp of a log line with a compiled log pattern
+ * output: where to write. Has room for LENGTH_OF_LOG_STAMP characters
+ * logLine: the log line
+ * pattern: the pattern compiled by compileLogPattern
+ * returns: the length of the stamp
+ */
+size_t Formatting::putLogPattern(char* output, const LogLineHeader& logLine, const LogPattern& pattern)
+{
+    char* position = output;
+    for (uint8_t i = 0; i < pattern.opCount; i++) {
+        const LogPattern::Op& op = pattern.ops[i];
+        char* end;
+        switch (op.type) {
+        case LogPattern::OP_TEXT:
+            memcpy(position, pattern.text + op.textOffset, op.textLength);
+            position += op.textLength;
+            continue;
+        case LogPattern::OP_TIME_LONG:
+            end = putTimeLong(position, logLine.timestamp) - 1; // The time renderers end with a space
+            break;
+        case LogPattern::OP_TIME_SHORT:
+            end = putTimeShort(position, logLine.timestamp) - 1;
+            break;
+        case LogPattern::OP_TIME_SIMPLE:
+            end = putTimeSimple(position, logLine.timestamp) - 1;
+            break;
+        case LogPattern::OP_LEVEL: {
+            const char* levelName = logLevelStrings[logLine.logLevel];
+            size_t levelLength = strlen(levelName);
+            memcpy(position, levelName, levelLength);
+            end = position + levelLength;
+            break;
+        }
+        case LogPattern::OP_SEQUENCE:
+            end = putUnsigned(position, logLine.sequence, 1);
+            break;
+        default:
+            end = position;
+            break;
+        }
+        position = fitField(position, end, op);
+    }
+    *position = '\0';
+    return position - output;
+}
+
+Formatting::CachedStamp Formatting::stampCache[WRITER_BATCH_SIZE][STAMP_CACHE_VARIANTS];
+uint8_t Formatting::stampCacheNext[WRITER_BATCH_SIZE];
+int64_t Formatting::epochOffset = 0;
+int64_t Formatting::epochOffsetChecked = 0;
+time_t Formatting::rtcPrefixSecond = -1;
+char Formatting::rtcPrefix[LENGTH_OF_RTC_PREFIX];
+portMUX_TYPE Formatting::timeCacheLock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Get the log stamp like getLogStamp, but render it only once when several sinks write the same log line.
+ * A stamp only depends on the time, sequence and level of the line and on the stamp plan of the
+ * registration, so the stamps rendered are kept and reused when they match. They are kept for each line
+ * of the writer batch, as the file sinks write the whole batch to one file after the other.
+ * Only for the writer task, with lines of its batch. The stamp returned is valid until the next call
+ * logLine: the log line. batchIndex selects the cache entries
+ * registrationPlan: the stamp plan of the registration
+ * length: if not nullptr, set to the length of the stamp
+ * returns: the stamp
+ */
+const char* Formatting::getLogStampCached(const LogLineHeader& logLine, const LogStampPlan& registrationPlan, size_t* length)
+{
+    LogStampPlan plan;
+    snapshotStampPlan(plan, registrationPlan);
+
+    uint8_t line = logLine.batchIndex % WRITER_BATCH_SIZE;
+    CachedStamp* cached = nullptr;
+    for (uint8_t i = 0; i < STAMP_CACHE_VARIANTS; i++) {
+        CachedStamp& slot = stampCache[line][i];
+        if (slot.plan.putTime != nullptr && slot.timestamp == logLine.timestamp && slot.sequence == logLine.sequence
+            && slot.logLevel == logLine.logLevel && memcmp(&slot.plan, &plan, sizeof(plan)) == 0) {
+            cached = &slot;
+            break;
+        }
+    }
+
+    if (cached == nullptr) {
+        cached = &stampCache[line][stampCacheNext[line]];
+        stampCacheNext[line] = (stampCacheNext[line] + 1) % STAMP_CACHE_VARIANTS;
+        cached->length = getLogStamp(cached->stamp, logLine, plan);
+        cached->timestamp = logLine.timestamp;
+        cached->sequence = logLine.sequence;
+        cached->logLevel = logLine.logLevel;
+        cached->plan = plan;
+    }
+
+    if (length != nullptr) {
+        *length = cached->length;
+    }
+    return cached->stamp;
+}
+
+/* Copy a stamp plan that another task may give a new log pattern at the same time. The pattern pointer is
+ * read once, as a whole, and the rest of the plan does not change after registration
+ * snapshot: the copy
+ * plan: the stamp plan of the registration
+ */
+void Formatting::snapshotStampPlan(LogStampPlan& snapshot, const LogStampPlan& plan)
+{
+    memset(&snapshot, 0, sizeof(snapshot)); // Snapshots are compared with memcmp
+    snapshot.putTime = plan.putTime;
+    snapshot.pattern = __atomic_load_n(&plan.pattern, __ATOMIC_ACQUIRE);
+    snapshot.sequence = plan.sequence;
+    snapshot.serviceTagLength = plan.serviceTagLength;
+    snapshot.levelTagLength = plan.levelTagLength;
+    memcpy(snapshot.serviceTag, plan.serviceTag, sizeof(snapshot.serviceTag));
 }
 
 /* Get the time string in the format of YYYY-MM-DD HH:MM:SS.mmm (if real time is provided) or ddd:HH:MM:SS.mmm (if real time is not provided
- * milliSeconds: the time in milliseconds
+ * microseconds: the time in microseconds since boot
  * output: the output string
  */
-void Formatting::getTimeLongString(char* output, const uint32_t milliSeconds)
+void Formatting::getTimeLongString(char* output, const uint64_t microseconds)
 {
-    if (realTimeProvided()) {
-        getTimeRtcString(output, milliSeconds);
-    } else {
-        getTimeMillisString(output, milliSeconds, false);
-    }
+    *putTimeLong(output, microseconds) = '\0';
 }
 
 /* Get the time string in the format of YYYY-MM-DD HH:MM:SS.mmm
  * output: the output string
- * milliseconds: the time in milliseconds
+ * microseconds: the time in microseconds since boot
  */
-void Formatting::getTimeRtcString(char* output, const uint32_t milliseconds)
+void Formatting::getTimeRtcString(char* output, const uint64_t microseconds)
 {
-    uint32_t millisSinceStamps = millis() - milliseconds;
+    *putTimeEpoch(output, getEpochOffset() + (int64_t)microseconds) = '\0';
+}
+
+/* Get the local time string of a real time in the format of YYYY-MM-DD HH:MM:SS.mmm
+ * output: the output string
+ * epochMicroseconds: the time in microseconds since 1970
+ */
+void Formatting::getTimeEpochString(char* output, const int64_t epochMicroseconds)
+{
+    *putTimeEpoch(output, epochMicroseconds) = '\0';
+}
+
+/* Write the local time of a real time like getTimeEpochString, without null terminator
+ * The date and time part is rendered once per second and reused by the following lines of the same second,
+ * so most lines only need the milliseconds added
+ * output: where to write
+ * epochMicroseconds: the time in microseconds since 1970
+ * returns: the position after the time
+ */
+char* Formatting::putTimeEpoch(char* output, const int64_t epochMicroseconds)
+{
+    time_t seconds = epochMicroseconds / 1000000;
+    uint32_t milliSeconds = (uint32_t)(epochMicroseconds - (int64_t)seconds * 1000000) / 1000;
+
+    portENTER_CRITICAL(&timeCacheLock);
+    bool cached = seconds == rtcPrefixSecond;
+    if (cached) {
+        memcpy(output, rtcPrefix, LENGTH_OF_RTC_PREFIX);
+    }
+    portEXIT_CRITICAL(&timeCacheLock);
 
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
+    if (!cached) {
+        struct tm tmstruct;
+        localtime_r(&seconds, &tmstruct);
+        char* position = putUnsigned(output, tmstruct.tm_year + 1900, 4);
+        *position++ = '-';
+        position = putTwoDigits(position, tmstruct.tm_mon + 1);
+        *position++ = '-';
+        position = putTwoDigits(position, tmstruct.tm_mday);
+        *position++ = ' ';
+        position = putTwoDigits(position, tmstruct.tm_hour);
+        *position++ = ':';
+        position = putTwoDigits(position, tmstruct.tm_min);
+        *position++ = ':';
+        putTwoDigits(position, tmstruct.tm_sec);
 
-    // Adjust the time with the time passed since the log time
-    tv.tv_sec -= millisSinceStamps / 1000;
-    if (tv.tv_usec < (millisSinceStamps % 1000) * 1000) {
-        tv.tv_sec--;
-        tv.tv_usec += 1000000;
+        portENTER_CRITICAL(&timeCacheLock);
+        memcpy(rtcPrefix, output, LENGTH_OF_RTC_PREFIX);
+        rtcPrefixSecond = seconds;
+        portEXIT_CRITICAL(&timeCacheLock);
     }
-    tv.tv_usec -= (millisSinceStamps % 1000) * 1000;
 
-    struct tm* tmstruct = localtime(&tv.tv_sec);
-    sprintf(output, "%04d-%02d-%02d %02d:%02d:%02d.%03d ", (tmstruct->tm_year) + 1900, (tmstruct->tm_mon) + 1, tmstruct->tm_mday, tmstruct->tm_hour, tmstruct->tm_min, tmstruct->tm_sec, (int)(tv.tv_usec / 1000));
+    char* position = output + LENGTH_OF_RTC_PREFIX;
+    *position++ = '.';
+    position = putThreeDigits(position, milliSeconds);
+    *position++ = ' ';
+    return position;
+}
+
+/* Get the offset from esp_timer_get_time() to the real time. The real time clock is read at most once every
+ * EPOCH_OFFSET_CHECK_US, so adjustments by SNTP or settimeofday are noticed within a second without reading
+ * the clock for every log line. Elog::provideTime makes it read right away (see timeChanged)
+ * returns: real time in microseconds since 1970 minus esp_timer_get_time()
+ */
+int64_t Formatting::getEpochOffset()
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&timeCacheLock);
+    int64_t offset = epochOffset;
+    bool check = epochOffsetChecked == 0 || now - epochOffsetChecked >= EPOCH_OFFSET_CHECK_US;
+    portEXIT_CRITICAL(&timeCacheLock);
+
+    if (check) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        offset = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - esp_timer_get_time();
+
+        portENTER_CRITICAL(&timeCacheLock);
+        epochOffset = offset;
+        epochOffsetChecked = now;
+        rtcPrefixSecond = -1; // The time zone may have changed too
+        portEXIT_CRITICAL(&timeCacheLock);
+    }
+    return offset;
+}
+
+/* Tell that the real time clock was set, so the next log line reads it again instead of using the cached offset
+ */
+void Formatting::timeChanged()
+{
+    portENTER_CRITICAL(&timeCacheLock);
+    epochOffsetChecked = 0;
+    portEXIT_CRITICAL(&timeCacheLock);
 }
 
 /* Get the time string in the format of ddd:HH:MM:SS.mmm
- * milliseconds: the time in milliseconds
+ * microseconds: the time in microseconds since boot
  * shortTimeFormat: if true, the output will be in the format of HH:MM:SS
  * output: the output string
  */
-void Formatting::getTimeMillisString(char* output, uint32_t milliSeconds, const bool shortTimeFormat)
+void Formatting::getTimeMillisString(char* output, const uint64_t microseconds, const bool shortTimeFormat)
 {
-    uint32_t seconds, minutes, hours, days;
-    seconds = milliSeconds / 1000;
+    *putTimeMillis(output, microseconds, shortTimeFormat) = '\0';
+}
+
+/* Write the time since boot like getTimeMillisString, without null terminator
+ * output: where to write
+ * microseconds: the time in microseconds since boot
+ * shortTimeFormat: if true, the output will be in the format of HH:MM:SS
+ * returns: the position after the time
+ */
+char* Formatting::putTimeMillis(char* output, const uint64_t microseconds, const bool shortTimeFormat)
+{
+    uint64_t fullSeconds = microseconds / 1000000; // The only 64 bit division
+    uint32_t seconds, minutes, hours, days, milliSeconds;
+    seconds = fullSeconds;
+    milliSeconds = (uint32_t)(microseconds - fullSeconds * 1000000) / 1000;
     minutes = seconds / 60;
     hours = minutes / 60;
     days = hours / 24;
 
-    if (shortTimeFormat) {
-        sprintf(output, "%02u:%02u:%02u ", hours % 24, minutes % 60, seconds % 60);
-    } else {
-        sprintf(output, "%03u:%02u:%02u:%02u.%03u ", days, hours % 24, minutes % 60, seconds % 60, milliSeconds % 1000);
+    char* position = output;
+    if (!shortTimeFormat) {
+        position = putUnsigned(position, days, 3);
+        *position++ = ':';
+    }
+    position = putTwoDigits(position, hours % 24);
+    *position++ = ':';
+    position = putTwoDigits(position, minutes % 60);
+    *position++ = ':';
+    position = putTwoDigits(position, seconds % 60);
+    if (!shortTimeFormat) {
+        *position++ = '.';
+        position = putThreeDigits(position, milliSeconds);
     }
+    *position++ = ' ';
+    return position;
 }
 
 /* Get the time string in the format of xxxxxxxxx (ms)
- * milliseconds: the time in milliseconds
+ * microseconds: the time in microseconds since boot
  * output: the output string
  */
-void Formatting::getSimpleTimeString(char* output, const uint32_t milliseconds)
+void Formatting::getSimpleTimeString(char* output, const uint64_t microseconds)
+{
+    *putTimeSimple(output, microseconds) = '\0';
+}
+
+/* The time formats a stamp plan can choose. Each writes the time without null terminator
+ * output: where to write
+ * microseconds: the time in microseconds since boot
+ * returns: the position after the time
+ */
+char* Formatting::putTimeSimple(char* output, const uint64_t microseconds)
+{
+    char* position = putUnsigned64(output, microseconds / 1000, 9);
+    *position++ = ' ';
+    return position;
+}
+
+char* Formatting::putTimeShort(char* output, const uint64_t microseconds)
 {
-    sprintf(output, "%09d ", milliseconds);
+    return putTimeMillis(output, microseconds, true);
+}
+
+char* Formatting::putTimeLong(char* output, const uint64_t microseconds)
+{
+    if (realTimeProvided()) {
+        return putTimeEpoch(output, getEpochOffset() + (int64_t)microseconds);
+    }
+    return putTimeMillis(output, microseconds, false);
+}
+
+char* Formatting::putTimeNone(char* output, const uint64_t microseconds)
+{
+    return output;
 }
 
 /* Get the service string in the format of [SERVIC]
@@ -115,9 +653,11 @@ void Formatting::getServiceString(char* output, const char* serviceName, const b
         return;
     }
     output[0] = '[';
+    bool ended = false;
     for (int i = 0; i < maxLength; i++) {
         output++;
-        if (serviceName[i] != '\0') {
+        ended = ended || serviceName[i] == '\0'; // Do not read past the end of short names
+        if (!ended) {
             output[0] = toupper(serviceName[i]);
         } else {
             output[0] = ' ';
@@ -134,13 +674,9 @@ void Formatting::getServiceString(char* output, const char* serviceName, const b
  */
 void Formatting::getLogLevelString(char* output, const uint8_t logLevel)
 {
-    char logLevelRawString[8];
-    getLogLevelStringRaw(logLevelRawString, logLevel);
-    sprintf(output, "[%-5s] ", logLevelRawString);
+    memcpy(output, logLevelTags[logLevel], LENGTH_OF_LEVEL);
 }
 
-static const char* logLevelStrings[ELOG_NUM_LOG_LEVELS] = { "ALWAY", "EMERG", "ALERT", "CRIT", "ERROR", "WARN", "NOTIC", "INFO", "DEBUG", "TRACE", "VERBO" };
-
 /* Get the log level string in the format of LOGLEVEL
  * logLevel: the log level
  * output: the output string
@@ -164,14 +700,68 @@ uint8_t Formatting::getLogLevelFromString(const char* logLevel)
     return ELOG_LEVEL_NOLOG;
 }
 
+static const char hexDigits[] = "0123456789ABCDEF";
+
+/* Get data as hex bytes separated by colons, like 01:A2:FF
+ * output: the output string. Must have room for length * 3 characters. Nothing is written if length is 0
+ * data: the data
+ * length: the number of bytes
+ */
+void Formatting::getHexString(char* output, const uint8_t* data, const uint16_t length)
+{
+    for (uint16_t i = 0; i < length; i++) {
+        *output++ = hexDigits[data[i] >> 4];
+        *output++ = hexDigits[data[i] & 0x0F];
+        *output++ = ':';
+    }
+    if (length > 0) {
+        output[-1] = '\0'; // replace the last ':' with null terminator
+    }
+}
+
+/* Get one line of a hexdump: offset, the bytes in hex and the bytes as ASCII, like
+ * 0010: 48 65 6C 6C 6F 00 ...  Hello.
+ * output: the output string. Must have room for LENGTH_OF_HEXDUMP_LINE + 1 characters
+ * offset: the offset of the first byte in the whole dump
+ * data: the bytes of this line
+ * length: the number of bytes. At most HEXDUMP_BYTES_PER_LINE
+ * return: the length of the line
+ */
+uint16_t Formatting::getHexDumpLine(char* output, const uint16_t offset, const uint8_t* data, const uint8_t length)
+{
+    char* position = output;
+    for (int8_t shift = 12; shift >= 0; shift -= 4) {
+        *position++ = hexDigits[(offset >> shift) & 0x0F];
+    }
+    *position++ = ':';
+    *position++ = ' ';
+
+    for (uint8_t i = 0; i < HEXDUMP_BYTES_PER_LINE; i++) {
+        if (i < length) {
+            *position++ = hexDigits[data[i] >> 4];
+            *position++ = hexDigits[data[i] & 0x0F];
+        } else { // Short last line. Keep the ASCII column aligned
+            *position++ = ' ';
+            *position++ = ' ';
+        }
+        *position++ = ' ';
+    }
+    *position++ = ' ';
+
+    for (uint8_t i = 0; i < length; i++) {
+        *position++ = data[i] >= 0x20 && data[i] < 0x7F ? data[i] : '.';
+    }
+    *position = '\0';
+    return position - output;
+}
+
 /* Check if the real time has been provided
  * return: true if real time has been provided, false otherwise
  */
 bool Formatting::realTimeProvided()
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec > 100000000; // We are after year 1973. Time must have been provided
+    int64_t now = getEpochOffset() + esp_timer_get_time();
+    return now / 1000000 > 100000000; // We are after year 1973. Time must have been provided
 }
 
 /* Get the human readable size (in bytes, kbytes, Mbytes)
@@ -8,27 +8,108 @@
 #define LENGTH_OF_TIME 25
 #define LENGTH_OF_SERVICE 10
 #define LENGTH_OF_LEVEL 9
-#define LENGTH_OF_LOG_STAMP LENGTH_OF_TIME + LENGTH_OF_SERVICE + LENGTH_OF_LEVEL + 1
+#define LENGTH_OF_SEQUENCE 12
+#define LENGTH_OF_LOG_STAMP LENGTH_OF_TIME + LENGTH_OF_SERVICE + LENGTH_OF_LEVEL + LENGTH_OF_SEQUENCE + 1
+#define LENGTH_OF_RTC_PREFIX 19 // "YYYY-MM-DD HH:MM:SS" without null terminator
+#define EPOCH_OFFSET_CHECK_US 1000000 // How often the real time clock is read to notice it was set or adjusted (SNTP)
+#define STAMP_CACHE_VARIANTS 2 // Stamps kept for each line of a writer batch. One per stamp plan in use
+#define LOG_PATTERN_OPS_MAX 16 // Fields and pieces of text in a log pattern
+#define LENGTH_OF_PATTERN_TEXT 48 // The fixed text of a log pattern, including the rendered service name
+#define HEXDUMP_BYTES_PER_LINE 16
+#define LENGTH_OF_HEXDUMP_LINE (6 + HEXDUMP_BYTES_PER_LINE * 3 + 1 + HEXDUMP_BYTES_PER_LINE) // "0010: 01 02 ... 0F  ................" without null terminator
+
+// A log pattern like "%T %-5L %S: %m", parsed once by Formatting::compileLogPattern into the steps that write it
+struct LogPattern {
+    enum OpType {
+        OP_TEXT, // Fixed text, the service name included
+        OP_TIME_LONG, // %T
+        OP_TIME_SHORT, // %t
+        OP_TIME_SIMPLE, // %M
+        OP_LEVEL, // %L
+        OP_SEQUENCE // %n
+    };
+
+    struct Op {
+        uint8_t type;
+        uint8_t width; // Pad the field with spaces to this width. 0 is no padding
+        uint8_t precision; // Cut the field to this length. 0 is no cut
+        bool leftAlign;
+        uint8_t textOffset; // OP_TEXT only
+        uint8_t textLength;
+    };
+
+    bool sequence; // The pattern shows the sequence number
+    uint8_t opCount;
+    Op ops[LOG_PATTERN_OPS_MAX];
+    char text[LENGTH_OF_PATTERN_TEXT];
+};
+
+// How a registration stamps its log lines. Compiled from its flags and service name by Formatting::compileStampPlan
+// when it registers, and not changed after that
+struct LogStampPlan {
+    char* (*putTime)(char* output, const uint64_t microseconds); // The time format chosen by the flags
+    LogPattern* pattern; // Used instead of the flags when not nullptr. Set once, never changed or freed
+    bool sequence; // Show the sequence number
+    uint8_t serviceTagLength;
+    uint8_t levelTagLength; // 0 if the level is not shown
+    char serviceTag[LENGTH_OF_SERVICE]; // "[SER] " rendered once
+};
 
 class Formatting {
+    struct CachedStamp {
+        uint64_t timestamp;
+        uint32_t sequence;
+        uint8_t logLevel;
+        LogStampPlan plan; // plan.putTime is nullptr when the slot was never used
+        size_t length;
+        char stamp[LENGTH_OF_LOG_STAMP];
+    };
+
 public:
-    static void getLogStamp(char* output, const uint32_t logTime, const uint8_t logLevel, const char* serviceName, const uint8_t logFlags);
+    static void compileStampPlan(LogStampPlan& plan, const char* serviceName, const uint8_t logFlags);
+    static bool compileLogPattern(LogStampPlan& plan, const char* serviceName, const char* pattern);
+    static size_t getLogStamp(char* output, const LogLineHeader& logLine, const LogStampPlan& plan);
+    static void getLogStamp(char* output, const LogLineHeader& logLine, const char* serviceName, const uint8_t logFlags);
+    static const char* getLogStampCached(const LogLineHeader& logLine, const LogStampPlan& registrationPlan, size_t* length = nullptr);
 
-    static void getTimeLongString(char* output, const uint32_t milliSeconds);
-    static void getTimeRtcString(char* output, const uint32_t milliseconds);
-    static void getTimeMillisString(char* output, const uint32_t milliSeconds, const bool shortTimeFormat);
-    static void getSimpleTimeString(char* output, const uint32_t milliseconds);
+    static void getTimeLongString(char* output, const uint64_t microseconds);
+    static void getTimeRtcString(char* output, const uint64_t microseconds);
+    static void getTimeEpochString(char* output, const int64_t epochMicroseconds);
+    static void getTimeMillisString(char* output, const uint64_t microseconds, const bool shortTimeFormat);
+    static void getSimpleTimeString(char* output, const uint64_t microseconds);
 
     static void getServiceString(char* output, const char* serviceName, bool longFormat);
     static void getLogLevelString(char* output, const uint8_t logLevel);
     static void getLogLevelStringRaw(char* output, const uint8_t logLevel);
     static uint8_t getLogLevelFromString(const char* logLevel);
+    static void getHexString(char* output, const uint8_t* data, const uint16_t length);
+    static uint16_t getHexDumpLine(char* output, const uint16_t offset, const uint8_t* data, const uint8_t length);
 
     static bool realTimeProvided();
+    static void timeChanged();
     static void getHumanSize(char* output, uint32_t size);
     static void getTimeStrFromEpoch(char* output, const time_t epoch);
     static void getHumanUptime(char* output, size_t outputSize);
     static void getRTCtime(char* output, size_t outputSize);
+
+private:
+    static CachedStamp stampCache[WRITER_BATCH_SIZE][STAMP_CACHE_VARIANTS]; // By position of the line in the writer batch
+    static uint8_t stampCacheNext[WRITER_BATCH_SIZE];
+    static int64_t epochOffset; // Real time in microseconds minus esp_timer_get_time()
+    static int64_t epochOffsetChecked; // esp_timer_get_time() when the real time clock was last read. 0 forces a read
+    static time_t rtcPrefixSecond; // The second rtcPrefix was rendered for. -1 if none
+    static char rtcPrefix[LENGTH_OF_RTC_PREFIX];
+    static portMUX_TYPE timeCacheLock;
+
+    static int64_t getEpochOffset();
+    static char* putTimeEpoch(char* output, const int64_t epochMicroseconds);
+    static char* putTimeMillis(char* output, const uint64_t microseconds, const bool shortTimeFormat);
+    static char* putTimeSimple(char* output, const uint64_t microseconds);
+    static char* putTimeShort(char* output, const uint64_t microseconds);
+    static char* putTimeLong(char* output, const uint64_t microseconds);
+    static char* putTimeNone(char* output, const uint64_t microseconds);
+    static void snapshotStampPlan(LogStampPlan& snapshot, const LogStampPlan& plan);
+    static size_t putLogPattern(char* output, const LogLineHeader& logLine, const LogPattern& pattern);
 };
 
 #endif // ELOG_FORMATTING_H
@@ -2,14 +2,55 @@
 #define ELOG_LOGRINGBUFF_H
 
 #include <Arduino.h>
-#include <freertos/semphr.h>
+#include <atomic>
+
+/* The ringbuffer can run in two modes:
+ * Line mode (buffCreate): a fixed number of elements of type T. Use buffPush/buffPop.
+ * Byte mode (buffCreateBytes): one preallocated arena of bytes. Each element of type T is stored as a
+ * length prefixed record together with a variable length body. Use buffReserveRecord/buffCommitRecord
+ * to write a record and buffPopRecord/buffReleaseRecords to read it. No heap is touched after creation.
+ *
+ * Both modes are lock-free. Any number of tasks on both cores can push or reserve at the same time without
+ * blocking each other. Line mode uses a slot per element with a sequence number telling whose turn it is,
+ * so it also allows several tasks to pop. Byte mode allows one consumer only.
+ */
+/* Number of bytes of an element stored in each byte mode record. Types with a part only used in line mode
+ * specialize this, so that part does not take space in the arena
+ */
+template <typename T>
+struct LogRingBuffRecordEntry {
+    static size_t size() { return sizeof(T); }
+};
 
 template <typename T>
 class LogRingBuff {
+    struct Slot {
+        std::atomic<size_t> sequence; // Equals the position when free, position + 1 when it holds an element
+        T entry;
+    };
+
+    struct RecordHeader {
+        std::atomic<uint32_t> size; // Size of the whole record including header and padding. 0 until committed
+        uint16_t bodyLength; // Length of the body without null terminator
+        uint16_t flags;
+    };
+
+    enum RecordFlags {
+        RECORD_WRAP = 0x01 // Filler at the end of the arena. Next record starts at the beginning
+    };
+
 public:
     bool buffCreate(size_t logLineCapacity);
+    bool buffCreateBytes(size_t byteCapacity);
     bool buffPush(const T& entry);
     bool buffPop(T& entry);
+    char* buffReserveRecord(const T& entry, uint16_t bodyLength);
+    static void buffCommitRecord(char* body);
+    bool buffPopRecord(T& entry, const char*& body);
+    void buffReleaseRecords();
+    void buffReleaseRecordsBefore(const char* body);
+    uint16_t buffMaxRecordBody() const;
+    bool buffIsByteMode() const;
     bool buffIsEmpty() const;
     bool buffIsFull() const;
     size_t buffSize() const;
@@ -17,115 +58,345 @@ public:
     uint8_t buffPercentageFull() const;
 
 private:
-    SemaphoreHandle_t semaphore;
-
-    T* entries = nullptr;
-    size_t size = 0;
-    size_t front = 0;
-    size_t rear = 0;
     size_t capacity = 0;
+
+    // Positions only ever grow. In line mode they wrap at the size of size_t, in byte mode at 2 * capacity
+    std::atomic<size_t> rear { 0 }; // Next position producers will use
+    std::atomic<size_t> front { 0 }; // Next position to be popped
+
+    Slot* slots = nullptr;
+    size_t mask = 0; // Line mode capacity is a power of two, so the slot index of a position is position & mask
+
+    uint8_t* arena = nullptr;
+    std::atomic<size_t> released { 0 }; // Byte mode: position up to which the consumer has given space back
+    std::atomic<size_t> records { 0 }; // Byte mode: number of records reserved and not yet popped
+
+    static size_t recordSize(uint16_t bodyLength);
+    void release(size_t length);
+    RecordHeader* recordAt(size_t position) const;
+    size_t advance(size_t position, size_t bytes) const;
+    size_t distance(size_t from, size_t to) const;
 };
 
 // Inline methods must be done inline in the header file in order for templates to work.
 
-/* Create a ringbuffer with a given capacity of elements */
+/* Create a ringbuffer with a given capacity of elements. The capacity is rounded up to a power of two */
 template <typename T>
 bool LogRingBuff<T>::buffCreate(size_t capacity)
 {
-    if (entries != nullptr) {
+    if (slots != nullptr || arena != nullptr) {
         return false; // Already created
     }
 
-    this->capacity = capacity;
-    size = 0;
-    front = 0;
-    rear = 0;
+    this->capacity = 1;
+    while (this->capacity < capacity) {
+        this->capacity <<= 1;
+    }
+    mask = this->capacity - 1;
 
     try {
-        entries = new T[capacity];
+        slots = new Slot[this->capacity];
     } catch (const std::bad_alloc& e) {
         return false; // Not enough memory
     }
 
-    semaphore = xSemaphoreCreateBinary();
-    xSemaphoreGive(semaphore); // Initialize semaphore to available state
+    for (size_t i = 0; i < this->capacity; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    rear.store(0);
+    front.store(0);
     return true;
 }
 
-/* Push an element to the ringbuffer */
+/* Create a ringbuffer as an arena of byteCapacity bytes. Records are variable length, so the number of
+ * elements that fits depends on the length of their bodies
+ */
 template <typename T>
-bool LogRingBuff<T>::buffPush(const T& entry)
+bool LogRingBuff<T>::buffCreateBytes(size_t byteCapacity)
 {
-    if (buffIsFull()) {
+    if (slots != nullptr || arena != nullptr) {
+        return false; // Already created
+    }
+
+    capacity = byteCapacity & ~(sizeof(RecordHeader) - 1); // Records are aligned to the header size
+    if (capacity < 2 * recordSize(0)) {
         return false;
     }
 
-    xSemaphoreTake(semaphore, portMAX_DELAY);
-    entries[rear] = entry; // Structs copied by assignment
-    rear = (rear + 1) % capacity;
-    size++;
-    xSemaphoreGive(semaphore);
+    try {
+        arena = reinterpret_cast<uint8_t*>(new uint64_t[capacity / sizeof(uint64_t)]()); // Zeroed. No record is committed
+    } catch (const std::bad_alloc& e) {
+        return false; // Not enough memory
+    }
+
+    rear.store(0);
+    front.store(0);
+    released.store(0);
+    records.store(0);
     return true;
 }
 
-/* Pop an element from the ringbuffer */
+/* Push an element to the ringbuffer. Returns false if it is full */
+template <typename T>
+bool LogRingBuff<T>::buffPush(const T& entry)
+{
+    size_t position = rear.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &slots[position & mask];
+        intptr_t difference = (intptr_t)slot->sequence.load(std::memory_order_acquire) - (intptr_t)position;
+        if (difference == 0) { // Slot is free. Try to claim it
+            if (rear.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false; // Slot still holds an element from the previous round. Buffer is full
+        } else {
+            position = rear.load(std::memory_order_relaxed); // Another task claimed it first
+        }
+    }
+
+    slot->entry = entry; // Structs copied by assignment
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+/* Pop an element from the ringbuffer. Returns false if it is empty */
 template <typename T>
 bool LogRingBuff<T>::buffPop(T& entry)
 {
-    if (buffIsEmpty()) {
-        return false;
+    size_t position = front.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &slots[position & mask];
+        intptr_t difference = (intptr_t)slot->sequence.load(std::memory_order_acquire) - (intptr_t)(position + 1);
+        if (difference == 0) { // Slot holds an element. Try to claim it
+            if (front.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false; // Empty, or the producer has not finished writing it yet
+        } else {
+            position = front.load(std::memory_order_relaxed);
+        }
     }
 
-    xSemaphoreTake(semaphore, portMAX_DELAY);
-    entry = entries[front];
-    front = (front + 1) % capacity;
-    size--;
-    xSemaphoreGive(semaphore);
+    entry = slot->entry;
+    slot->sequence.store(position + mask + 1, std::memory_order_release); // Free for the next round
     return true;
 }
 
+/* Reserve a record for entry with room for a body of bodyLength characters plus null terminator (byte mode only)
+ * The body must be written to the returned pointer and then handed to buffCommitRecord
+ * Returns nullptr if there is not room enough in the arena right now
+ */
+template <typename T>
+char* LogRingBuff<T>::buffReserveRecord(const T& entry, uint16_t bodyLength)
+{
+    size_t needed = recordSize(bodyLength);
+    if (bodyLength > buffMaxRecordBody()) {
+        return nullptr; // Will never fit. Caller should respect buffMaxRecordBody()
+    }
+
+    size_t position = rear.load(std::memory_order_relaxed);
+    size_t offset, roomAtEnd, total;
+    do {
+        offset = position >= capacity ? position - capacity : position;
+        roomAtEnd = capacity - offset;
+        total = needed <= roomAtEnd ? needed : roomAtEnd + needed; // Record may not be split at the end of the arena
+        if (distance(released.load(std::memory_order_acquire), position) + total > capacity) {
+            return nullptr;
+        }
+    } while (!rear.compare_exchange_weak(position, advance(position, total), std::memory_order_relaxed));
+    records.fetch_add(1, std::memory_order_relaxed);
+
+    if (needed > roomAtEnd) { // Fill the end of the arena and start over from the beginning
+        RecordHeader* wrap = recordAt(offset);
+        wrap->bodyLength = 0;
+        wrap->flags = RECORD_WRAP;
+        wrap->size.store(roomAtEnd, std::memory_order_release);
+        offset = 0;
+    }
+
+    RecordHeader* header = recordAt(offset);
+    header->bodyLength = bodyLength;
+    header->flags = 0;
+
+    uint8_t* record = reinterpret_cast<uint8_t*>(header);
+    memcpy(record + sizeof(RecordHeader), &entry, LogRingBuffRecordEntry<T>::size());
+    char* body = reinterpret_cast<char*>(record + sizeof(RecordHeader) + LogRingBuffRecordEntry<T>::size());
+    body[bodyLength] = '\0';
+    return body;
+}
+
+/* Mark a record returned by buffReserveRecord as completely written. From now on the consumer can pop it */
+template <typename T>
+void LogRingBuff<T>::buffCommitRecord(char* body)
+{
+    RecordHeader* header = reinterpret_cast<RecordHeader*>(body - LogRingBuffRecordEntry<T>::size() - sizeof(RecordHeader));
+    header->size.store(recordSize(header->bodyLength), std::memory_order_release);
+}
+
+/* Pop the oldest record from the arena (byte mode only)
+ * body will point directly into the arena and stays valid until buffReleaseRecords is called
+ * Returns false if there is nothing to pop or the oldest record is not committed yet
+ */
+template <typename T>
+bool LogRingBuff<T>::buffPopRecord(T& entry, const char*& body)
+{
+    size_t position = front.load(std::memory_order_relaxed);
+    while (position != rear.load(std::memory_order_acquire)) {
+        RecordHeader* header = recordAt(position);
+        uint32_t size = header->size.load(std::memory_order_acquire);
+        if (size == 0) {
+            return false; // Producer is still writing it
+        }
+
+        position = advance(position, size);
+        front.store(position, std::memory_order_relaxed);
+        if (header->flags & RECORD_WRAP) {
+            continue;
+        }
+
+        uint8_t* record = reinterpret_cast<uint8_t*>(header);
+        memcpy(&entry, record + sizeof(RecordHeader), LogRingBuffRecordEntry<T>::size());
+        body = reinterpret_cast<const char*>(record + sizeof(RecordHeader) + LogRingBuffRecordEntry<T>::size());
+        records.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+/* Give the space of all popped records back to the producers. Bodies of popped records are invalid afterwards
+ * The space is zeroed, so a record header reserved there later reads as not committed until it is
+ */
+template <typename T>
+void LogRingBuff<T>::buffReleaseRecords()
+{
+    release(distance(released.load(std::memory_order_relaxed), front.load(std::memory_order_relaxed)));
+}
+
+/* Give the space of popped records back to the producers, except the record with body and the ones popped after it
+ * Used when a record has been popped, but must stay valid while older records are given back
+ */
+template <typename T>
+void LogRingBuff<T>::buffReleaseRecordsBefore(const char* body)
+{
+    size_t from = released.load(std::memory_order_relaxed);
+    size_t fromOffset = from >= capacity ? from - capacity : from;
+    size_t offset = reinterpret_cast<const uint8_t*>(body) - LogRingBuffRecordEntry<T>::size() - sizeof(RecordHeader) - arena;
+    release(offset >= fromOffset ? offset - fromOffset : offset + capacity - fromOffset);
+}
+
+/* Zero length bytes of popped records starting at the released position and hand them back to the producers */
+template <typename T>
+void LogRingBuff<T>::release(size_t length)
+{
+    if (length == 0) {
+        return;
+    }
+    size_t from = released.load(std::memory_order_relaxed);
+    size_t fromOffset = from >= capacity ? from - capacity : from;
+
+    if (fromOffset + length > capacity) { // Released space wraps around the end of the arena
+        memset(arena + fromOffset, 0, capacity - fromOffset);
+        memset(arena, 0, length - (capacity - fromOffset));
+    } else {
+        memset(arena + fromOffset, 0, length);
+    }
+    released.store(advance(from, length), std::memory_order_release);
+}
+
+/* Returns the longest body that can ever fit in the arena. A record may take up to half the arena,
+ * so it always fits in an empty arena even if it has to wrap around the end
+ */
+template <typename T>
+uint16_t LogRingBuff<T>::buffMaxRecordBody() const
+{
+    size_t maxBody = ((capacity / 2) & ~(sizeof(RecordHeader) - 1)) - sizeof(RecordHeader) - LogRingBuffRecordEntry<T>::size() - 1;
+    return maxBody > UINT16_MAX ? UINT16_MAX : maxBody;
+}
+
+/* Returns true if the ringbuffer was created with buffCreateBytes */
+template <typename T>
+bool LogRingBuff<T>::buffIsByteMode() const
+{
+    return arena != nullptr;
+}
+
 /* Returns true if the ringbuffer is full */
 template <typename T>
 bool LogRingBuff<T>::buffIsFull() const
 {
-    return size == capacity;
+    if (arena != nullptr) {
+        return distance(released.load(), rear.load()) + recordSize(0) > capacity;
+    }
+    return buffSize() >= capacity;
 }
 
 /* Returns true if the ringbuffer is empty */
 template <typename T>
 bool LogRingBuff<T>::buffIsEmpty() const
 {
-    return size == 0;
+    return buffSize() == 0;
 }
 
 /* Returns the number of elements in the ringbuffer */
 template <typename T>
 size_t LogRingBuff<T>::buffSize() const
 {
-    xSemaphoreTake(semaphore, portMAX_DELAY);
-    size_t s = size;
-    xSemaphoreGive(semaphore);
-    return s;
+    if (arena != nullptr) {
+        return records.load();
+    }
+    size_t poppedUntil = front.load(); // Load front first, so rear is never behind it
+    return rear.load() - poppedUntil;
 }
 
-/* Returns the maximum allowed elements in the ringbuffer */
+/* Returns the maximum allowed elements in the ringbuffer. In byte mode it is the size of the arena in bytes */
 template <typename T>
 size_t LogRingBuff<T>::buffCapacity() const
 {
-    xSemaphoreTake(semaphore, portMAX_DELAY);
-    size_t c = capacity;
-    xSemaphoreGive(semaphore);
-    return c;
+    return capacity;
 }
 
 /* Return how many percent of the ringbuffer is used. */
 template <typename T>
 uint8_t LogRingBuff<T>::buffPercentageFull() const
 {
-    xSemaphoreTake(semaphore, portMAX_DELAY);
-    uint8_t ringBuffPercentage = size * 100 / capacity;
-    xSemaphoreGive(semaphore);
-    return ringBuffPercentage;
+    size_t used = arena != nullptr ? distance(released.load(), rear.load()) : buffSize();
+    return used * 100 / capacity;
+}
+
+/* Returns the number of arena bytes used by a record with a body of bodyLength characters */
+template <typename T>
+size_t LogRingBuff<T>::recordSize(uint16_t bodyLength)
+{
+    size_t size = sizeof(RecordHeader) + LogRingBuffRecordEntry<T>::size() + bodyLength + 1; // +1 for null terminator
+    return (size + sizeof(RecordHeader) - 1) & ~(sizeof(RecordHeader) - 1);
+}
+
+/* Returns the record header at a position in the arena */
+template <typename T>
+typename LogRingBuff<T>::RecordHeader* LogRingBuff<T>::recordAt(size_t position) const
+{
+    return reinterpret_cast<RecordHeader*>(arena + (position >= capacity ? position - capacity : position));
+}
+
+/* Returns position moved bytes forward. Byte mode positions wrap at 2 * capacity, so a full arena
+ * can be told apart from an empty one
+ */
+template <typename T>
+size_t LogRingBuff<T>::advance(size_t position, size_t bytes) const
+{
+    position += bytes;
+    return position >= 2 * capacity ? position - 2 * capacity : position;
+}
+
+/* Returns the number of bytes from one byte mode position to a later one */
+template <typename T>
+size_t LogRingBuff<T>::distance(size_t from, size_t to) const
+{
+    return to >= from ? to - from : to + 2 * capacity - from;
 }
 
 #endif // ELOG_LOGRINGBUFF_H
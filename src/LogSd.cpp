@@ -85,6 +85,7 @@ void LogSD::registerSd(const uint8_t logId, const uint8_t loglevel, const char*
     setting->bytesWritten = 0;
 
     setting->logFlags = logFlags | ELOG_FLAG_NO_SERVICE; // Servicename makes no sense in a file
+    formatter.compileStampPlan(setting->stampPlan, "", setting->logFlags);
     setting->sdFileCreteLastTry = LONG_MIN; // This triggers log file creation immediately
 
     char logLevelStr[10];
@@ -114,6 +115,32 @@ void LogSD::setLogLevel(const uint8_t logId, const uint8_t loglevel, const char*
     }
 }
 
+/* Stamp the log lines of a registered SD log file with a log pattern instead of its log flags
+ * logId: the id of the log
+ * pattern: the log pattern (see Formatting::compileLogPattern)
+ * fileName: the name of the log file
+ * return: true if the pattern shows the sequence number of the log lines
+ */
+bool LogSD::setLogPattern(const uint8_t logId, const char* pattern, const char* fileName)
+{
+    bool sequence = false;
+    for (uint8_t i = 0; i < registeredSdCount; i++) {
+        Setting* setting = &settings[i];
+        if (setting->logId == logId && strcmp(setting->fileName, fileName) == 0) {
+            if (setting->stampPlan.pattern != nullptr) {
+                Logger.logInternal(ELOG_LEVEL_ERROR, "Log pattern \"%s\" refused. A log pattern can only be set once", pattern);
+                return false;
+            }
+            if (!formatter.compileLogPattern(setting->stampPlan, "", pattern)) {
+                Logger.logInternal(ELOG_LEVEL_ERROR, "Invalid log pattern \"%s\". Log flags are still used", pattern);
+                return false;
+            }
+            sequence |= setting->stampPlan.pattern->sequence;
+        }
+    }
+    return sequence;
+}
+
 uint8_t LogSD::getLastMsgLogLevel(const uint8_t logId, const char* fileName)
 {
     for (uint8_t i = 0; i < registeredSdCount; i++) {
@@ -126,19 +153,35 @@ uint8_t LogSD::getLastMsgLogLevel(const uint8_t logId, const char* fileName)
     return ELOG_LEVEL_NOLOG;
 }
 
-/* Output the logline to the SD log files. Traverse all registered log files and output to the ones that match the logId and logLevel
- * logLineEntry: The logline to output
+/* Output a batch of loglines to the SD log files. For each registered log file, the loglines that match its logId and logLevel
+ * are collected and written together, so the card gets a few large writes instead of three small writes per line
+ * logLineEntries: The loglines to output, oldest first
+ * count: The number of loglines
  */
-void LogSD::outputFromBuffer(const LogLineEntry logLineEntry)
+void LogSD::outputFromBuffer(const LogLineEntry* logLineEntries, const uint16_t count)
 {
     for (uint8_t i = 0; i < registeredSdCount; i++) {
         Setting* setting = &settings[i];
-        if (setting->logId == logLineEntry.logId && (setting->logLevel != ELOG_LEVEL_NOLOG || logLineEntry.logLevel == ELOG_LEVEL_ALWAYS)) {
-            if (logLineEntry.logLevel <= setting->logLevel) {
-                setting->lastMsgLogLevel = logLineEntry.logLevel;
-                write(logLineEntry, *setting);
+        for (uint16_t n = 0; n < count; n++) {
+            const LogLineEntry& logLineEntry = logLineEntries[n];
+            if (setting->logId == logLineEntry.logId && (setting->logLevel != ELOG_LEVEL_NOLOG || logLineEntry.logLevel == ELOG_LEVEL_ALWAYS)) {
+                if (logLineEntry.logLevel <= setting->logLevel) {
+                    setting->lastMsgLogLevel = logLineEntry.logLevel;
+                    write(logLineEntry, *setting);
+                }
+            }
+        }
+        flushWriteBuffer(*setting);
+    }
+
+    if (peekEnabled) { // Peek output is done afterwards, so lines from all files are shown in the order they were logged
+        for (uint16_t n = 0; n < count; n++) {
+            for (uint8_t i = 0; i < registeredSdCount; i++) {
+                Setting* setting = &settings[i];
+                if (setting->logId == logLineEntries[n].logId && (setting->logLevel != ELOG_LEVEL_NOLOG || logLineEntries[n].logLevel == ELOG_LEVEL_ALWAYS)) {
+                    handlePeek(logLineEntries[n], i);
+                }
             }
-            handlePeek(logLineEntry, i); // If peek is enabled from query command
         }
     }
 }
@@ -152,8 +195,7 @@ void LogSD::handlePeek(const LogLineEntry logLineEntry, const uint8_t settingInd
     if (peekEnabled) {
         if (peekAllFiles || peekSettingIndex == settingIndex) {
             if (logLineEntry.logLevel <= peekLoglevel) {
-                char logStamp[LENGTH_OF_LOG_STAMP];
-                formatter.getLogStamp(logStamp, logLineEntry.timestamp, logLineEntry.logLevel, "", settings[settingIndex].logFlags);
+                const char* logStamp = formatter.getLogStampCached(logLineEntry, settings[settingIndex].stampPlan);
 
                 if (peekFilter) {
                     if (strcasestr(logLineEntry.logMessage, peekFilterText) != NULL) {
@@ -169,15 +211,56 @@ void LogSD::handlePeek(const LogLineEntry logLineEntry, const uint8_t settingInd
     }
 }
 
-/*  Write the logline to the SD card. If the SD card is not present, we try to reconnect. If we cant reconnect, we discard the message.
-    If the file is not open, we try to create it. If we cant create it, we discard the message.
-    If the file is too big, we close it and try to create a new one.
+/*  Add the logline to the write buffer of the file. The buffer is written to the card by flushWriteBuffer
+    when it is full, and before the line would make the file reach its max size, so files are rotated as before.
     logLineEntry: The logline to write
     setting: The setting for the log file
 */
-void LogSD::write(LogLineEntry logLineEntry, Setting& setting)
+void LogSD::write(const LogLineEntry& logLineEntry, Setting& setting)
+{
+    size_t stampLength;
+    const char* logStamp = formatter.getLogStampCached(logLineEntry, setting.stampPlan, &stampLength);
+    size_t messageLength = strlen(logLineEntry.logMessage);
+
+    if (writeBufferLength > 0 && setting.bytesWritten + writeBufferLength + stampLength + messageLength + 2 > setting.maxLogFileSize) {
+        flushWriteBuffer(setting); // Let the file be rotated before this line
+    }
+
+    appendWriteBuffer(setting, logStamp, stampLength);
+    appendWriteBuffer(setting, logLineEntry.logMessage, messageLength);
+    appendWriteBuffer(setting, "\r\n", 2);
+    writeBufferLines++;
+}
+
+/* Copy text to the write buffer. Whenever the buffer gets full it is written to the file
+ * setting: The setting for the log file
+ * text: The text to add
+ * length: The length of text
+ */
+void LogSD::appendWriteBuffer(Setting& setting, const char* text, size_t length)
+{
+    while (length > 0) {
+        size_t chunk = min(length, sizeof(writeBuffer) - writeBufferLength);
+        memcpy(writeBuffer + writeBufferLength, text, chunk);
+        writeBufferLength += chunk;
+        text += chunk;
+        length -= chunk;
+        if (writeBufferLength == sizeof(writeBuffer)) {
+            flushWriteBuffer(setting);
+        }
+    }
+}
+
+/*  Write the content of the write buffer to the log file. If the SD card is not present, we try to reconnect. If we cant reconnect, we discard the messages.
+    If the file is not open, we try to create it. If we cant create it, we discard the messages.
+    If the file is too big, we close it and try to create a new one.
+    setting: The setting for the log file
+*/
+void LogSD::flushWriteBuffer(Setting& setting)
 {
-    static char logStamp[LENGTH_OF_LOG_STAMP];
+    if (writeBufferLength == 0) {
+        return;
+    }
 
     if (sdConfigured && !sdCardPresent) {
         reconnect();
@@ -185,55 +268,47 @@ void LogSD::write(LogLineEntry logLineEntry, Setting& setting)
 
     if (sdConfigured) {
         if (sdCardPresent) {
-            formatter.getLogStamp(logStamp, logLineEntry.timestamp, logLineEntry.logLevel, "", setting.logFlags);
-
             createLogFileIfClosed(setting);
             if (setting.sdFileHandle->isOpen()) { // Are we working on a valid file?
                 ensureFreeSpace();
-                size_t bytesWritten; // Number of bytes written should be the same as content length
-                size_t expectedBytes = strlen(logStamp) + strlen(logLineEntry.logMessage) + 2; // 2 chars for endline
-
-                bytesWritten = setting.sdFileHandle->print(logStamp);
-                bytesWritten += setting.sdFileHandle->print(logLineEntry.logMessage);
-                bytesWritten += setting.sdFileHandle->println();
+                size_t bytesWritten = setting.sdFileHandle->write(writeBuffer, writeBufferLength);
 
-                if (bytesWritten != expectedBytes) { // If not everything is written, then the SD must be ejected.
+                if (bytesWritten != writeBufferLength) { // If not everything is written, then the SD must be ejected.
                     sdCardPresent = false;
-                    stats.messagesDiscardedTotal++;
+                    stats.messagesDiscardedTotal += writeBufferLines;
                     Logger.logInternal(ELOG_LEVEL_WARNING, "SD card ejected");
                     allFilesClose();
                 } else { // Data written succesfully.
-                    stats.messagesWrittenTotal++;
+                    stats.messagesWrittenTotal += writeBufferLines;
                     stats.bytesWrittenTotal += bytesWritten;
                     setting.bytesWritten += bytesWritten;
                 }
             } else { // If we dont have a valid filehandle we try do create it periodically
-                stats.messagesDiscardedTotal++;
+                stats.messagesDiscardedTotal += writeBufferLines;
             }
             allFilesSync(); // Keep files synced to card periodically
             ensureFileSize(setting); // Check if we need to rotate the file
-        } else { // If we dont have a valid SD card, we discard the message
-            stats.messagesDiscardedTotal++;
+        } else { // If we dont have a valid SD card, we discard the messages
+            stats.messagesDiscardedTotal += writeBufferLines;
         }
     }
+
+    writeBufferLength = 0;
+    writeBufferLines = 0;
 }
 
-/* Traverse all registered log files and check if the logId and logLevel match the setting
- * logId: The log id
- * logLevel: The log level
- * return: true if the log should be written to filesystem
+/* Add the log levels of all registrations to the table used by Elog::mustLog
+ * logLevelLimits: one entry per logId holding the highest log level that must be logged + 1. 0 means nothing
  */
-bool LogSD::mustLog(const uint8_t logId, const uint8_t logLevel)
+void LogSD::addLogLevelLimits(uint8_t* logLevelLimits)
 {
     for (uint8_t i = 0; i < registeredSdCount; i++) {
         Setting* setting = &settings[i];
-        if (setting->logId == logId) {
-            if (logLevel <= setting->logLevel && (setting->logLevel != ELOG_LEVEL_NOLOG || logLevel == ELOG_LEVEL_ALWAYS)) {
-                return true;
-            }
+        uint8_t limit = setting->logLevel == ELOG_LEVEL_NOLOG ? ELOG_LEVEL_ALWAYS + 1 : setting->logLevel + 1; // NOLOG still lets ALWAYS through
+        if (limit > logLevelLimits[setting->logId]) {
+            logLevelLimits[setting->logId] = limit;
         }
     }
-    return false;
 }
 
 /* Output the statistics for the SD card
@@ -18,6 +18,7 @@
 
 #define SD_RECONNECT_EVERY 5000
 #define SD_SYNC_FILES_EVERY 5000
+#define SD_WRITE_BUFFER_SIZE 1024 // Log lines of a batch are collected and written to the card in chunks of this size
 
 using namespace std;
 
@@ -34,6 +35,7 @@ class LogSD {
         uint8_t lastMsgLogLevel;
         uint32_t sdFileCreteLastTry;
         uint8_t logFlags;
+        LogStampPlan stampPlan;
         uint8_t fileNumber;
         uint32_t bytesWritten;
         uint32_t maxLogFileSize;
@@ -51,11 +53,12 @@ public:
     void registerSd(const uint8_t logId, const uint8_t loglevel, const char* fileName, const uint8_t logFlags, const uint32_t maxLogFileSize);
     uint8_t getLogLevel(const uint8_t logId, const char* fileName);
     void setLogLevel(const uint8_t logId, const uint8_t loglevel, const char* fileName);
+    bool setLogPattern(const uint8_t logId, const char* pattern, const char* fileName);
     uint8_t getLastMsgLogLevel(const uint8_t logId, const char* fileName);
-    void outputFromBuffer(const LogLineEntry logLineEntry);
+    void outputFromBuffer(const LogLineEntry* logLineEntries, const uint16_t count);
     void handlePeek(const LogLineEntry logLineEntry, const uint8_t settingIndex);
-    void write(LogLineEntry logLineEntry, Setting& setting);
-    bool mustLog(const uint8_t logId, const uint8_t logLevel);
+    void write(const LogLineEntry& logLineEntry, Setting& setting);
+    void addLogLevelLimits(uint8_t* logLevelLimits);
     void outputStats();
     void enableQuery(Stream& querySerial);
     void peekStop();
@@ -105,6 +108,10 @@ private:
     uint16_t sdLogNumber = 0;
     uint8_t filesInLogDir = 0;
 
+    char writeBuffer[SD_WRITE_BUFFER_SIZE]; // Log lines waiting to be written to one file
+    uint16_t writeBufferLength = 0;
+    uint16_t writeBufferLines = 0; // Number of complete log lines in writeBuffer
+
     bool isValidFileName(const char* fileName);
     bool isFileNameRegistered(const char* fileName);
 
@@ -131,6 +138,8 @@ private:
     uint32_t convertToEpoch(uint16_t pdate, uint16_t ptime);
 
     void createLogFileIfClosed(Setting& setting);
+    void appendWriteBuffer(Setting& setting, const char* text, size_t length);
+    void flushWriteBuffer(Setting& setting);
     void allFilesClose();
     void allFilesSync();
 };
@@ -141,9 +150,9 @@ public:
     void begin() {};
     void configure(void* spi, const uint8_t cs, const uint32_t speed, uint8_t spiOption, const uint8_t maxRegistrations) {};
     void registerSd(const uint8_t logId, const uint8_t loglevel, const char* fileName, const uint8_t logFlags, const uint32_t maxLogFileSize) {};
-    void outputFromBuffer(const LogLineEntry logLineEntry) {};
+    void outputFromBuffer(const LogLineEntry* logLineEntries, const uint16_t count) {};
     void handlePeek(const LogLineEntry logLineEntry, const uint8_t settingIndex) {};
-    bool mustLog(const uint8_t logId, const uint8_t logLevel) { return false; };
+    void addLogLevelLimits(uint8_t* logLevelLimits) { }
     void outputStats() {};
     void enableQuery(Stream& querySerial) {};
     void peekStop() {};
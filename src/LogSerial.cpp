@@ -48,6 +48,7 @@ void LogSerial::registerSerial(const uint8_t logId, const uint8_t loglevel, cons
     setting->logLevel = loglevel;
     setting->lastMsgLogLevel = ELOG_LEVEL_NOLOG;
     setting->logFlags = logFlags;
+    formatter.compileStampPlan(setting->stampPlan, serviceName, logFlags);
 
     char logLevelStr[10];
     formatter.getLogLevelStringRaw(logLevelStr, loglevel);
@@ -76,6 +77,32 @@ void LogSerial::setLogLevel(const uint8_t logId, const uint8_t loglevel, Stream&
     }
 }
 
+/* Stamp the log lines of a registered serial port with a log pattern instead of its log flags
+ * logId: the id of the log
+ * pattern: the log pattern (see Formatting::compileLogPattern)
+ * serial: the serial port
+ * return: true if the pattern shows the sequence number of the log lines
+ */
+bool LogSerial::setLogPattern(const uint8_t logId, const char* pattern, Stream& serial)
+{
+    bool sequence = false;
+    for (uint8_t i = 0; i < registeredSerialCount; i++) {
+        Setting* setting = &settings[i];
+        if (setting->logId == logId && setting->serial == &serial) {
+            if (setting->stampPlan.pattern != nullptr) {
+                Logger.logInternal(ELOG_LEVEL_ERROR, "Log pattern \"%s\" refused. A log pattern can only be set once", pattern);
+                return false;
+            }
+            if (!formatter.compileLogPattern(setting->stampPlan, setting->serviceName, pattern)) {
+                Logger.logInternal(ELOG_LEVEL_ERROR, "Invalid log pattern \"%s\". Log flags are still used", pattern);
+                return false;
+            }
+            sequence |= setting->stampPlan.pattern->sequence;
+        }
+    }
+    return sequence;
+}
+
 uint8_t LogSerial::getLastMsgLogLevel(const uint8_t logId, Stream& serial)
 {
     for (uint8_t i = 0; i < registeredSerialCount; i++) {
@@ -88,24 +115,83 @@ uint8_t LogSerial::getLastMsgLogLevel(const uint8_t logId, Stream& serial)
     return ELOG_LEVEL_NOLOG;
 }
 
-/* Output the logline to the registered serial ports
+/* Write an internal log message of the logger to the internal log device
  * logLineEntry: the log line entry
- * muteSerialOutput: if true, the logline will not be output to the serial port
+ * internalLogDevice: the device to write to (see Elog::configureInternalLogging)
  */
-void LogSerial::outputFromBuffer(const LogLineEntry logLineEntry, bool muteSerialOutput)
+void LogSerial::writeInternal(const LogLineHeader& logLineEntry, Stream* internalLogDevice)
 {
-    if (logLineEntry.internalLogDevice != nullptr) {
-        Setting settingUnusable = { 0, nullptr, nullptr, ELOG_LEVEL_NOLOG };
-        write(logLineEntry, settingUnusable);
-    } else {
+    static char logStamp[LENGTH_OF_LOG_STAMP];
+
+    formatter.getLogStamp(logStamp, logLineEntry, "LOG", 0);
+    internalLogDevice->print(logStamp);
+    internalLogDevice->println(logLineEntry.logMessage);
+}
+
+/* Output a batch of loglines to the serial ports. Lines going to the same serial port one after another are
+ * collected and written with one call, so the order of the lines on each port is kept
+ * logLineEntries: the log line entries, oldest first
+ * count: the number of log line entries
+ * muteSerialOutput: if true, the log lines are not written. Only peek output is done
+ */
+void LogSerial::outputFromBuffer(const LogLineEntry* logLineEntries, const uint16_t count, bool muteSerialOutput)
+{
+    for (uint16_t n = 0; n < count; n++) {
+        const LogLineEntry& logLineEntry = logLineEntries[n];
         for (uint8_t i = 0; i < registeredSerialCount; i++) {
             Setting* setting = &settings[i];
             if (setting->logId == logLineEntry.logId && (setting->logLevel != ELOG_LEVEL_NOLOG || logLineEntry.logLevel == ELOG_LEVEL_ALWAYS)) {
-                if (logLineEntry.logLevel <= setting->logLevel && !muteSerialOutput) {
+                if (logLineEntry.logLevel <= setting->logLevel && !muteSerialOutput && !isSynchronous(logLineEntry)) {
                     setting->lastMsgLogLevel = logLineEntry.logLevel;
-                    write(logLineEntry, *setting);
+                    writeBuffered(logLineEntry, *setting);
                 }
-                handlePeek(logLineEntry, i); // If peek is enabled from query command
+                if (peekEnabled) {
+                    flushWriteBuffer(); // Peek output may go to the same serial port
+                    handlePeek(logLineEntry, i);
+                }
+            }
+        }
+    }
+    flushWriteBuffer();
+}
+
+/* Returns true if the logline was already written to the serial ports by writeSynchronous
+ * logLineEntry: the log line entry
+ */
+bool LogSerial::isSynchronous(const LogLineEntry& logLineEntry)
+{
+    return logLineEntry.flags & LOG_LINE_SYNCHRONOUS;
+}
+
+/* Write a logline to the registered serial ports right away from the task that logs it. Used for severe messages
+ * that must not wait behind the log buffer. Stamp, message and line end are written with one call when they fit
+ * the line buffer, so the line is not split by the writer task writing to the same port.
+ * Called by many tasks at once, so the stats and the write buffer of the writer task are not touched
+ * logLineEntry: the log line entry with the formatted message
+ * muteSerialOutput: if true, nothing is written
+ */
+void LogSerial::writeSynchronous(const LogLineEntry& logLineEntry, bool muteSerialOutput)
+{
+    if (!isSynchronous(logLineEntry) || muteSerialOutput) {
+        return;
+    }
+
+    char line[LENGTH_OF_LOG_STAMP + ELOG_SCRATCH_SIZE + 2];
+    for (uint8_t i = 0; i < registeredSerialCount; i++) {
+        Setting* setting = &settings[i];
+        if (setting->logId == logLineEntry.logId && logLineEntry.logLevel <= setting->logLevel
+            && (setting->logLevel != ELOG_LEVEL_NOLOG || logLineEntry.logLevel == ELOG_LEVEL_ALWAYS)) {
+            setting->lastMsgLogLevel = logLineEntry.logLevel;
+
+            size_t stampLength = formatter.getLogStamp(line, logLineEntry, setting->stampPlan);
+            size_t messageLength = strlen(logLineEntry.logMessage);
+            if (stampLength + messageLength + 2 <= sizeof(line)) {
+                memcpy(line + stampLength, logLineEntry.logMessage, messageLength);
+                memcpy(line + stampLength + messageLength, "\r\n", 2);
+                setting->serial->write((const uint8_t*)line, stampLength + messageLength + 2);
+            } else {
+                setting->serial->print(line);
+                setting->serial->println(logLineEntry.logMessage);
             }
         }
     }
@@ -120,8 +206,7 @@ void LogSerial::handlePeek(const LogLineEntry logLineEntry, const uint8_t settin
     if (peekEnabled) {
         if (peekAllServices || settingIndex == peekSettingIndex) {
             if (logLineEntry.logLevel <= peekLoglevel) {
-                char logStamp[LENGTH_OF_LOG_STAMP];
-                formatter.getLogStamp(logStamp, logLineEntry.timestamp, logLineEntry.logLevel, settings[settingIndex].serviceName, settings[settingIndex].logFlags);
+                const char* logStamp = formatter.getLogStampCached(logLineEntry, settings[settingIndex].stampPlan);
 
                 if (peekFilter) {
                     if (strcasestr(logLineEntry.logMessage, peekFilterText) != NULL) {
@@ -137,48 +222,65 @@ void LogSerial::handlePeek(const LogLineEntry logLineEntry, const uint8_t settin
     }
 }
 
-/* Traverse all the registered serial ports and check if the logId and logLevel match the setting
- * logId: the log id
- * logLevel: the log level
+/* Add the log levels of all registrations to the table used by Elog::mustLog
+ * logLevelLimits: one entry per logId holding the highest log level that must be logged + 1. 0 means nothing
  */
-bool LogSerial::mustLog(const uint8_t logId, const uint8_t logLevel)
+void LogSerial::addLogLevelLimits(uint8_t* logLevelLimits)
 {
     for (uint8_t i = 0; i < registeredSerialCount; i++) {
         Setting* setting = &settings[i];
-        if (setting->logId == logId) {
-            if (logLevel <= setting->logLevel && (setting->logLevel != ELOG_LEVEL_NOLOG || logLevel == ELOG_LEVEL_ALWAYS)) {
-                return true;
-            }
+        uint8_t limit = setting->logLevel == ELOG_LEVEL_NOLOG ? ELOG_LEVEL_ALWAYS + 1 : setting->logLevel + 1; // NOLOG still lets ALWAYS through
+        if (limit > logLevelLimits[setting->logId]) {
+            logLevelLimits[setting->logId] = limit;
         }
     }
-    return false;
 }
 
-/* Write the logline to the serial port
+/* Add the logline to the write buffer. The buffer is written when it is full, or when a line for another serial port comes
  * logLineEntry: the log line entry
  * setting: the setting for the serial port
  */
-void LogSerial::write(LogLineEntry logLineEntry, Setting& setting)
+void LogSerial::writeBuffered(const LogLineEntry& logLineEntry, Setting& setting)
 {
-    static char logStamp[LENGTH_OF_LOG_STAMP];
-    char* service;
-    Stream* logSerial;
+    if (setting.serial != writeBufferSerial) {
+        flushWriteBuffer();
+    }
 
-    if (logLineEntry.internalLogDevice != nullptr) {
-        service = (char*)"LOG";
-        logSerial = logLineEntry.internalLogDevice;
+    size_t stampLength;
+    const char* logStamp = formatter.getLogStampCached(logLineEntry, setting.stampPlan, &stampLength);
+    appendWriteBuffer(setting.serial, logStamp, stampLength);
+    appendWriteBuffer(setting.serial, logLineEntry.logMessage, strlen(logLineEntry.logMessage));
+    appendWriteBuffer(setting.serial, "\r\n", 2);
+    stats.messagesWrittenTotal++;
+}
 
-        formatter.getLogStamp(logStamp, logLineEntry.timestamp, logLineEntry.logLevel, service, setting.logFlags);
-        logSerial->print(logStamp);
-        logSerial->println(logLineEntry.logMessage);
-    } else {
-        service = (char*)setting.serviceName;
-        logSerial = setting.serial;
+/* Copy text to the write buffer. Whenever the buffer gets full it is written to the serial port
+ * serial: the serial port the text is for
+ * text: the text to add
+ * length: the length of text
+ */
+void LogSerial::appendWriteBuffer(Stream* serial, const char* text, size_t length)
+{
+    writeBufferSerial = serial;
+    while (length > 0) {
+        size_t chunk = min(length, sizeof(writeBuffer) - writeBufferLength);
+        memcpy(writeBuffer + writeBufferLength, text, chunk);
+        writeBufferLength += chunk;
+        text += chunk;
+        length -= chunk;
+        if (writeBufferLength == sizeof(writeBuffer)) {
+            flushWriteBuffer();
+        }
+    }
+}
 
-        formatter.getLogStamp(logStamp, logLineEntry.timestamp, logLineEntry.logLevel, service, setting.logFlags);
-        stats.bytesWrittenTotal += logSerial->print(logStamp);
-        stats.bytesWrittenTotal += logSerial->println(logLineEntry.logMessage);
-        stats.messagesWrittenTotal++;
+/* Write the content of the write buffer to its serial port
+ */
+void LogSerial::flushWriteBuffer()
+{
+    if (writeBufferLength > 0) {
+        stats.bytesWrittenTotal += writeBufferSerial->write((const uint8_t*)writeBuffer, writeBufferLength);
+        writeBufferLength = 0;
     }
 }
 
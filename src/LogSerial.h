@@ -5,6 +5,8 @@
 #include <LogFormat.h>
 #include <LogCommon.h>
 
+#define SERIAL_WRITE_BUFFER_SIZE 256 // Log lines of a batch are collected and written to the serial port in chunks of this size
+
 using namespace std;
 
 class LogSerial {
@@ -15,6 +17,7 @@ class LogSerial {
         uint8_t logLevel;
         uint8_t lastMsgLogLevel;
         uint8_t logFlags;
+        LogStampPlan stampPlan;
     };
 
     struct Stats {
@@ -28,10 +31,13 @@ public:
     void registerSerial(const uint8_t logId, const uint8_t loglevel, const char* serviceName, Stream& serial, const uint8_t logFlags);
     uint8_t getLogLevel(const uint8_t logId, Stream& serial);
     void setLogLevel(const uint8_t logId, const uint8_t loglevel, Stream& serial);
+    bool setLogPattern(const uint8_t logId, const char* pattern, Stream& serial);
     uint8_t getLastMsgLogLevel(const uint8_t logId, Stream& serial);
-    void outputFromBuffer(const LogLineEntry logLineEntry, bool muteSerialOutput);
+    void writeInternal(const LogLineHeader& logLineEntry, Stream* internalLogDevice);
+    void outputFromBuffer(const LogLineEntry* logLineEntries, const uint16_t count, bool muteSerialOutput);
+    void writeSynchronous(const LogLineEntry& logLineEntry, bool muteSerialOutput);
     void handlePeek(const LogLineEntry logLineEntry, const uint8_t settingIndex);
-    bool mustLog(const uint8_t logId, const uint8_t logLevel);
+    void addLogLevelLimits(uint8_t* logLevelLimits);
     void outputStats();
     uint8_t registeredCount();
 
@@ -60,7 +66,14 @@ private:
 
     Stream* querySerial = nullptr;
 
-    void write(LogLineEntry logLineEntry, Setting& setting);
+    char writeBuffer[SERIAL_WRITE_BUFFER_SIZE]; // Log lines waiting to be written to writeBufferSerial
+    uint16_t writeBufferLength = 0;
+    Stream* writeBufferSerial = nullptr;
+
+    bool isSynchronous(const LogLineEntry& logLineEntry);
+    void writeBuffered(const LogLineEntry& logLineEntry, Setting& setting);
+    void appendWriteBuffer(Stream* serial, const char* text, size_t length);
+    void flushWriteBuffer();
 };
 
 #endif // ELOG_LOGSERIAL_H
@@ -0,0 +1,163 @@
+#include <LogSlab.h>
+
+/* Set the number of blocks of each class. They are reserved when the first message needs a block
+ * blocksPerClass: the number of blocks of 64, 128, 256 and 512 bytes
+ */
+void LogSlab::slabConfigure(const uint16_t* blocksPerClass)
+{
+    memcpy(this->blocksPerClass, blocksPerClass, sizeof(this->blocksPerClass));
+}
+
+/* Returns true if the blocks can be used. The first call reserves them. Tasks calling while another task
+ * reserves them get false and use heap
+ */
+bool LogSlab::arenaReady()
+{
+    uint8_t state = arenaState.load(std::memory_order_acquire);
+    if (state == ARENA_NONE && arenaState.compare_exchange_strong(state, ARENA_CREATING)) {
+        state = createArena() ? ARENA_READY : ARENA_FAILED;
+        arenaState.store(state, std::memory_order_release);
+    }
+    return state == ARENA_READY;
+}
+
+/* Reserve the blocks of all classes in one piece of heap
+ * returns: false if there is not enough heap memory
+ */
+bool LogSlab::createArena()
+{
+    size_t arenaSize = 0;
+    size_t bitmapWords = 0;
+    for (uint8_t i = 0; i < SLAB_CLASSES; i++) {
+        arenaSize += (size_t)(SLAB_SMALLEST_BLOCK << i) * blocksPerClass[i];
+        bitmapWords += (blocksPerClass[i] + 31) / 32;
+    }
+
+    std::atomic<uint32_t>* bitmaps;
+    try {
+        arena = new char[arenaSize];
+        bitmaps = new std::atomic<uint32_t>[bitmapWords];
+    } catch (const std::bad_alloc& e) {
+        delete[] arena;
+        arena = nullptr;
+        return false;
+    }
+
+    char* blocks = arena;
+    for (uint8_t i = 0; i < SLAB_CLASSES; i++) {
+        SlabClass& slabClass = classes[i];
+        slabClass.blockSize = SLAB_SMALLEST_BLOCK << i;
+        slabClass.blockCount = blocksPerClass[i];
+        slabClass.blocks = blocks;
+        slabClass.used = bitmaps;
+        slabClass.inUse.store(0);
+        slabClass.highWater.store(0);
+        slabClass.fallbacks.store(0);
+
+        for (uint16_t word = 0; word < (slabClass.blockCount + 31) / 32; word++) {
+            uint16_t blocksInWord = slabClass.blockCount - word * 32 > 32 ? 32 : slabClass.blockCount - word * 32;
+            slabClass.used[word].store(blocksInWord == 32 ? 0 : ~((1UL << blocksInWord) - 1)); // Bits after the last block are never free
+        }
+        blocks += slabClass.blockSize * slabClass.blockCount;
+        bitmaps += (slabClass.blockCount + 31) / 32;
+    }
+    arenaEnd = blocks;
+    return true;
+}
+
+/* Get memory for a log message
+ * size: the number of bytes needed
+ * returns: the memory, or nullptr if there is not even heap memory left
+ */
+char* LogSlab::slabAllocate(size_t size)
+{
+    if (arenaReady()) {
+        uint8_t first = 0;
+        while (first < SLAB_CLASSES && classes[first].blockSize < size) {
+            first++;
+        }
+        for (uint8_t i = first; i < SLAB_CLASSES; i++) {
+            char* block = allocateBlock(classes[i]);
+            if (block != nullptr) {
+                return block;
+            }
+        }
+        if (first < SLAB_CLASSES) {
+            classes[first].fallbacks++;
+        } else {
+            oversized++;
+        }
+    }
+
+    try {
+        return new char[size];
+    } catch (const std::bad_alloc& e) {
+        return nullptr;
+    }
+}
+
+/* Give back memory returned by slabAllocate
+ * memory: the memory
+ */
+void LogSlab::slabRelease(const char* memory)
+{
+    if (arenaState.load(std::memory_order_acquire) != ARENA_READY || memory < arena || memory >= arenaEnd) {
+        delete[] memory; // Fallback to heap
+        return;
+    }
+    for (uint8_t i = 0; i < SLAB_CLASSES; i++) {
+        if (memory < classes[i].blocks + classes[i].blockSize * classes[i].blockCount) {
+            releaseBlock(classes[i], memory);
+            return;
+        }
+    }
+}
+
+/* Print the use of each block size for the status query command
+ * querySerial: the serial port to print to
+ */
+void LogSlab::slabQueryStatus(Stream* querySerial)
+{
+    if (arenaState.load(std::memory_order_acquire) != ARENA_READY) {
+        querySerial->printf("message blocks: none reserved, %s\n", arenaState.load() == ARENA_FAILED ? "not enough heap memory" : "no message needed one yet");
+        return;
+    }
+    for (uint8_t i = 0; i < SLAB_CLASSES; i++) {
+        SlabClass& slabClass = classes[i];
+        querySerial->printf("message blocks, %d bytes: %d of %d used, max used: %d, heap fallbacks: %d\n", slabClass.blockSize,
+            slabClass.inUse.load(), slabClass.blockCount, slabClass.highWater.load(), slabClass.fallbacks.load());
+    }
+    querySerial->printf("message blocks, longer messages from heap: %d\n", oversized.load());
+}
+
+/* Claim a free block of a class
+ * slabClass: the class
+ * returns: the block, or nullptr if all blocks are in use
+ */
+char* LogSlab::allocateBlock(SlabClass& slabClass)
+{
+    for (uint16_t word = 0; word < (slabClass.blockCount + 31) / 32; word++) {
+        uint32_t used = slabClass.used[word].load(std::memory_order_relaxed);
+        while (used != UINT32_MAX) {
+            uint8_t bit = __builtin_ctz(~used);
+            if (slabClass.used[word].compare_exchange_weak(used, used | (1UL << bit), std::memory_order_acquire)) {
+                uint16_t inUse = slabClass.inUse.fetch_add(1) + 1;
+                uint16_t highWater = slabClass.highWater.load();
+                while (inUse > highWater && !slabClass.highWater.compare_exchange_weak(highWater, inUse)) { }
+                return slabClass.blocks + (word * 32 + bit) * slabClass.blockSize;
+            }
+        }
+    }
+    return nullptr;
+}
+
+/* Mark a block of a class as free
+ * slabClass: the class
+ * memory: the block
+ */
+void LogSlab::releaseBlock(SlabClass& slabClass, const char* memory)
+{
+    uint16_t block = (memory - slabClass.blocks) / slabClass.blockSize;
+    slabClass.inUse--;
+    slabClass.used[block / 32].fetch_and(~(1UL << (block % 32)), std::memory_order_release);
+}
@@ -0,0 +1,59 @@
+#ifndef ELOG_LOGSLAB_H
+#define ELOG_LOGSLAB_H
+
+#include <Arduino.h>
+#include <atomic>
+
+#define SLAB_CLASSES 4 // Block sizes 64, 128, 256 and 512 bytes. Shorter messages are stored in the log line entry
+#define SLAB_SMALLEST_BLOCK 64
+
+/* LogSlab hands out memory for log messages from blocks reserved once when the logger is configured.
+ * There is a class of blocks for each size. A message gets a block of the smallest class it fits in, or a bigger
+ * one if that class is used up. When no block is free, or the message is longer than the biggest block,
+ * the memory is taken from heap and counted as a fallback.
+ * Long running devices then do not fragment the heap that WiFi and TLS need.
+ * The blocks are reserved when the first message needs one, so a logger whose messages all fit in the
+ * log line entries never reserves them.
+ *
+ * Blocks in use are marked in a bitmap per class, so any number of tasks on both cores can allocate and
+ * release at the same time without locking.
+ */
+class LogSlab {
+    struct SlabClass {
+        uint16_t blockSize;
+        uint16_t blockCount;
+        char* blocks; // First block of the class in the arena
+        std::atomic<uint32_t>* used; // One bit per block
+        std::atomic<uint16_t> inUse;
+        std::atomic<uint16_t> highWater;
+        std::atomic<uint32_t> fallbacks; // Messages of this size taken from heap
+    };
+
+public:
+    void slabConfigure(const uint16_t* blocksPerClass);
+    char* slabAllocate(size_t size);
+    void slabRelease(const char* memory);
+    void slabQueryStatus(Stream* querySerial);
+
+private:
+    SlabClass classes[SLAB_CLASSES];
+    enum ArenaState {
+        ARENA_NONE, // Not reserved yet
+        ARENA_CREATING, // Being reserved by a task. Others use heap meanwhile
+        ARENA_READY,
+        ARENA_FAILED // Not enough heap memory. All messages use heap
+    };
+
+    uint16_t blocksPerClass[SLAB_CLASSES];
+    std::atomic<uint8_t> arenaState { ARENA_NONE };
+    char* arena = nullptr; // Only read once arenaState is ARENA_READY
+    char* arenaEnd = nullptr;
+    std::atomic<uint32_t> oversized { 0 }; // Messages longer than the biggest block
+
+    bool arenaReady();
+    bool createArena();
+    char* allocateBlock(SlabClass& slabClass);
+    void releaseBlock(SlabClass& slabClass, const char* memory);
+};
+
+#endif // ELOG_LOGSLAB_H
@@ -67,6 +67,7 @@ void LogSpiffs::registerSpiffs(const uint8_t logId, const uint8_t loglevel, cons
     setting->maxLogFileSize = maxLogFileSize;
 
     setting->logFlags = logFlags | ELOG_FLAG_NO_SERVICE; // Servicename makes no sense in a file
+    formatter.compileStampPlan(setting->stampPlan, "", setting->logFlags);
 
     char logLevelStr[10];
     formatter.getLogLevelStringRaw(logLevelStr, loglevel);
@@ -95,6 +96,32 @@ void LogSpiffs::setLogLevel(const uint8_t logId, const uint8_t loglevel, const c
     }
 }
 
+/* Stamp the log lines of a registered SPIFFS log file with a log pattern instead of its log flags
+ * logId: the id of the log
+ * pattern: the log pattern (see Formatting::compileLogPattern)
+ * fileName: the name of the log file
+ * return: true if the pattern shows the sequence number of the log lines
+ */
+bool LogSpiffs::setLogPattern(const uint8_t logId, const char* pattern, const char* fileName)
+{
+    bool sequence = false;
+    for (uint8_t i = 0; i < fileSettingsCount; i++) {
+        Setting* setting = &settings[i];
+        if (setting->logId == logId && strcmp(setting->fileName, fileName) == 0) {
+            if (setting->stampPlan.pattern != nullptr) {
+                Logger.logInternal(ELOG_LEVEL_ERROR, "Log pattern \"%s\" refused. A log pattern can only be set once", pattern);
+                return false;
+            }
+            if (!formatter.compileLogPattern(setting->stampPlan, "", pattern)) {
+                Logger.logInternal(ELOG_LEVEL_ERROR, "Invalid log pattern \"%s\". Log flags are still used", pattern);
+                return false;
+            }
+            sequence |= setting->stampPlan.pattern->sequence;
+        }
+    }
+    return sequence;
+}
+
 uint8_t LogSpiffs::getLastMsgLogLevel(const uint8_t logId, const char* fileName)
 {
     for (uint8_t i = 0; i < fileSettingsCount; i++) {
@@ -107,22 +134,38 @@ uint8_t LogSpiffs::getLastMsgLogLevel(const uint8_t logId, const char* fileName)
     return ELOG_LEVEL_NOLOG;
 }
 
-/* Output the logline to the SPIFFS log files. Traverse all registered log files and output to the ones that match the logId and logLevel
- * logLineEntry: The logline to output
+/* Output a batch of loglines to the SPIFFS log files. For each registered log file, the loglines that match its logId and logLevel
+ * are collected and written together, so each file gets a few large writes instead of three small writes per line
+ * logLineEntries: The loglines to output, oldest first
+ * count: The number of loglines
  */
-void LogSpiffs::outputFromBuffer(const LogLineEntry logLineEntry)
+void LogSpiffs::outputFromBuffer(const LogLineEntry* logLineEntries, const uint16_t count)
 {
     for (uint8_t i = 0; i < fileSettingsCount; i++) {
         Setting* setting = &settings[i];
-        if (setting->logId == logLineEntry.logId && (setting->logLevel != ELOG_LEVEL_NOLOG || logLineEntry.logLevel == ELOG_LEVEL_ALWAYS)) {
-            if (logLineEntry.logLevel <= setting->logLevel) {
-                setting->lastMsgLogLevel = logLineEntry.logLevel;
-                if (ensureFilesystemConfigured()) {
-                    write(logLineEntry, *setting);
-                    allFilesSync();
+        for (uint16_t n = 0; n < count; n++) {
+            const LogLineEntry& logLineEntry = logLineEntries[n];
+            if (setting->logId == logLineEntry.logId && (setting->logLevel != ELOG_LEVEL_NOLOG || logLineEntry.logLevel == ELOG_LEVEL_ALWAYS)) {
+                if (logLineEntry.logLevel <= setting->logLevel) {
+                    setting->lastMsgLogLevel = logLineEntry.logLevel;
+                    if (ensureFilesystemConfigured()) {
+                        write(logLineEntry, *setting);
+                    }
+                }
+            }
+        }
+        flushWriteBuffer(*setting);
+    }
+    allFilesSync();
+
+    if (peekEnabled) { // Peek output is done afterwards, so lines from all files are shown in the order they were logged
+        for (uint16_t n = 0; n < count; n++) {
+            for (uint8_t i = 0; i < fileSettingsCount; i++) {
+                Setting* setting = &settings[i];
+                if (setting->logId == logLineEntries[n].logId && (setting->logLevel != ELOG_LEVEL_NOLOG || logLineEntries[n].logLevel == ELOG_LEVEL_ALWAYS)) {
+                    handlePeek(logLineEntries[n], i);
                 }
             }
-            handlePeek(logLineEntry, i); // If peek is enabled from query command
         }
     }
 }
@@ -136,8 +179,7 @@ void LogSpiffs::handlePeek(const LogLineEntry logLineEntry, const uint8_t settin
     if (peekEnabled) {
         if (peekAllFiles || peekSettingIndex == settingIndex) {
             if (logLineEntry.logLevel <= peekLoglevel) {
-                char logStamp[LENGTH_OF_LOG_STAMP];
-                formatter.getLogStamp(logStamp, logLineEntry.timestamp, logLineEntry.logLevel, "", settings[settingIndex].logFlags);
+                const char* logStamp = formatter.getLogStampCached(logLineEntry, settings[settingIndex].stampPlan);
 
                 if (peekFilter) {
                     if (strcasestr(logLineEntry.logMessage, peekFilterText) != NULL) {
@@ -153,52 +195,88 @@ void LogSpiffs::handlePeek(const LogLineEntry logLineEntry, const uint8_t settin
     }
 }
 
-/* Write the logline to the SPIFFS log file
+/* Add the logline to the write buffer of the file. The buffer is written to the file by flushWriteBuffer
+ * when it is full, and before the line would make the file reach its max size, so files are rotated as before.
  * logLineEntry: The logline to write
  * setting: The setting for the file
  */
-void LogSpiffs::write(LogLineEntry logLineEntry, Setting& setting)
+void LogSpiffs::write(const LogLineEntry& logLineEntry, Setting& setting)
 {
-    static char logStamp[LENGTH_OF_LOG_STAMP];
+    size_t stampLength;
+    const char* logStamp = formatter.getLogStampCached(logLineEntry, setting.stampPlan, &stampLength);
+    size_t messageLength = strlen(logLineEntry.logMessage);
 
-    if (ensureOpenFile(setting)) {
-        formatter.getLogStamp(logStamp, logLineEntry.timestamp, logLineEntry.logLevel, "", setting.logFlags);
-        size_t bytesWritten; // Number of bytes written should be the same as content length
-        size_t expectedBytes = strlen(logStamp) + strlen(logLineEntry.logMessage) + 2; // 2 chars for endline
+    if (writeBufferLength > 0 && setting.bytesWritten + writeBufferLength + stampLength + messageLength + 2 > setting.maxLogFileSize) {
+        flushWriteBuffer(setting); // Let the file be rotated before this line
+    }
 
-        bytesWritten = setting.spiffsFileHandle.print(logStamp);
-        bytesWritten += setting.spiffsFileHandle.print(logLineEntry.logMessage);
-        bytesWritten += setting.spiffsFileHandle.println();
+    appendWriteBuffer(setting, logStamp, stampLength);
+    appendWriteBuffer(setting, logLineEntry.logMessage, messageLength);
+    appendWriteBuffer(setting, "\r\n", 2);
+    writeBufferLines++;
+}
+
+/* Copy text to the write buffer. Whenever the buffer gets full it is written to the file
+ * setting: The setting for the file
+ * text: The text to add
+ * length: The length of text
+ */
+void LogSpiffs::appendWriteBuffer(Setting& setting, const char* text, size_t length)
+{
+    while (length > 0) {
+        size_t chunk = min(length, sizeof(writeBuffer) - writeBufferLength);
+        memcpy(writeBuffer + writeBufferLength, text, chunk);
+        writeBufferLength += chunk;
+        text += chunk;
+        length -= chunk;
+        if (writeBufferLength == sizeof(writeBuffer)) {
+            flushWriteBuffer(setting);
+        }
+    }
+}
 
-        if (bytesWritten == expectedBytes) {
+/* Write the content of the write buffer to the SPIFFS log file. If the file can not be opened, the messages are discarded
+ * setting: The setting for the file
+ */
+void LogSpiffs::flushWriteBuffer(Setting& setting)
+{
+    if (writeBufferLength == 0) {
+        return;
+    }
+
+    if (ensureOpenFile(setting)) {
+        size_t bytesWritten = setting.spiffsFileHandle.write((const uint8_t*)writeBuffer, writeBufferLength);
+
+        if (bytesWritten == writeBufferLength) {
             stats.bytesWrittenTotal += bytesWritten;
-            stats.messagesWrittenTotal++;
+            stats.messagesWrittenTotal += writeBufferLines;
             setting.bytesWritten += bytesWritten;
         } else {
-            stats.messagesDiscardedTotal++;
-            Logger.logInternal(ELOG_LEVEL_ERROR, "Failed to write to SPIFFS:%s/%s. Expected writing %d bytes, wrote %d bytes", currentLogDir, setting.fileName, expectedBytes, bytesWritten);
+            stats.messagesDiscardedTotal += writeBufferLines;
+            Logger.logInternal(ELOG_LEVEL_ERROR, "Failed to write to SPIFFS:%s/%s. Expected writing %d bytes, wrote %d bytes", currentLogDir, setting.fileName, writeBufferLength, bytesWritten);
         }
         ensureFreeSpace();
         ensureFileSize(setting);
+    } else {
+        stats.messagesDiscardedTotal += writeBufferLines;
     }
+
+    writeBufferLength = 0;
+    writeBufferLines = 0;
 }
 
-/* Traverse all registered log files and check if the logId and logLevel match the setting
- * logId: The log id
- * logLevel: The log level
- * return: true if the log should be written to filesystem
+/* Add the log levels of all registrations to the table used by Elog::mustLog
+ * logLevelLimits: one entry per logId holding the highest log level that must be logged + 1. 0 means nothing
  */
-bool LogSpiffs::mustLog(const uint8_t logId, const uint8_t logLevel)
+void LogSpiffs::addLogLevelLimits(uint8_t* logLevelLimits)
 {
     for (uint8_t i = 0; i < fileSettingsCount; i++) {
         Setting* setting = &settings[i];
-        if (setting->logId == logId) {
-            if (logLevel <= setting->logLevel && (setting->logLevel != ELOG_LEVEL_NOLOG || logLevel == ELOG_LEVEL_ALWAYS)) {
-                return true;
-            }
+        uint8_t limit = setting->logLevel == ELOG_LEVEL_NOLOG ? ELOG_LEVEL_ALWAYS + 1 : setting->logLevel + 1; // NOLOG still lets ALWAYS through
+        if (limit > logLevelLimits[setting->logId]) {
+            logLevelLimits[setting->logId] = limit;
         }
     }
-    return false;
 }
 
 /* Output the SPIFFS stats
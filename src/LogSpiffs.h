@@ -11,6 +11,7 @@
 
 #define SPIFFS_MIN_FREE_SPACE 20000 // 20kB
 #define SPIFFS_SYNC_FILES_EVERY 5000 // 5s
+#define SPIFFS_WRITE_BUFFER_SIZE 512 // Log lines of a batch are collected and written to the file in chunks of this size
 
 #define SPIFFS_LOGNUMBER_FILE "/lognumber.txt"
 #define SPIFFS_LOG_ROOT "/logs"
@@ -24,6 +25,7 @@ class LogSpiffs {
         uint8_t logLevel;
         uint8_t lastMsgLogLevel;
         uint8_t logFlags;
+        LogStampPlan stampPlan;
         File spiffsFileHandle;
         uint8_t fileNumber;
         uint32_t maxLogFileSize;
@@ -42,11 +44,12 @@ public:
     void registerSpiffs(const uint8_t logId, const uint8_t loglevel, const char* fileName, const uint8_t logFlags, const uint32_t maxLogFileSize);
     uint8_t getLogLevel(const uint8_t logId, const char* fileName);
     void setLogLevel(const uint8_t logId, const uint8_t loglevel, const char* fileName);
+    bool setLogPattern(const uint8_t logId, const char* pattern, const char* fileName);
     uint8_t getLastMsgLogLevel(const uint8_t logId, const char* fileName);
-    void outputFromBuffer(const LogLineEntry logLineEntry);
+    void outputFromBuffer(const LogLineEntry* logLineEntries, const uint16_t count);
     void handlePeek(const LogLineEntry logLineEntry, const uint8_t settingIndex);
-    void write(LogLineEntry logLineEntry, Setting& setting);
-    bool mustLog(const uint8_t logId, const uint8_t logLevel);
+    void write(const LogLineEntry& logLineEntry, Setting& setting);
+    void addLogLevelLimits(uint8_t* logLevelLimits);
     void outputStats();
     void enableQuery(Stream& querySerial);
     void peekStop();
@@ -85,6 +88,10 @@ private:
 
     Stream* querySerial; // output device for query commands
 
+    char writeBuffer[SPIFFS_WRITE_BUFFER_SIZE]; // Log lines waiting to be written to one file
+    uint16_t writeBufferLength = 0;
+    uint16_t writeBufferLines = 0; // Number of complete log lines in writeBuffer
+
     bool isFileOpen(const char* fileName);
     bool isValidFileName(const char* fileName);
     bool isFileNameRegistered(const char* fileName);
@@ -96,6 +103,8 @@ private:
     bool ensureOpenFile(Setting& setting);
     void ensureFreeSpace();
     void ensureFileSize(Setting& setting);
+    void appendWriteBuffer(Setting& setting, const char* text, size_t length);
+    void flushWriteBuffer(Setting& setting);
 
     void allFilesSync();
     void allFilesClose();
@@ -107,9 +116,9 @@ class LogSpiffs {
 public:
     void begin() {};
     void registerSpiffs(const uint8_t logId, const uint8_t loglevel, const char* fileName, const uint8_t logFlags, const uint32_t maxLogFileSize) {};
-    void outputFromBuffer(const LogLineEntry logLineEntry) {};
+    void outputFromBuffer(const LogLineEntry* logLineEntries, const uint16_t count) {};
     void handlePeek(const LogLineEntry logLineEntry, const uint8_t settingIndex) {};
-    bool mustLog(const uint8_t logId, const uint8_t logLevel) { return false; };
+    void addLogLevelLimits(uint8_t* logLevelLimits) { }
     void outputStats() {};
     void enableQuery(Stream& querySerial) {};
     void peekStop() {};
@@ -62,6 +62,7 @@ void LogSyslog::registerSyslog(const uint8_t logId, const uint8_t loglevel, cons
     setting->facility = facility;
     setting->logLevel = loglevel;
     setting->lastMsgLogLevel = ELOG_LEVEL_NOLOG;
+    formatter.compileStampPlan(setting->stampPlan, appName, 0);
 
     char logLevelStr[10];
     formatter.getLogLevelStringRaw(logLevelStr, loglevel);
@@ -102,19 +103,24 @@ uint8_t LogSyslog::getLastMsgLogLevel(const uint8_t logId, const uint8_t facilit
     return ELOG_LEVEL_NOLOG;
 }
 
-/* Output the logline to the registered syslogs
- * logLineEntry: the log line entry
+/* Output a batch of loglines to the registered syslogs
+ * Each logline is still sent as a datagram of its own. Syslog over UDP (RFC 5426) allows only one message per datagram
+ * logLineEntries: the log line entries, oldest first
+ * count: the number of log line entries
  */
-void LogSyslog::outputFromBuffer(const LogLineEntry logLineEntry)
+void LogSyslog::outputFromBuffer(const LogLineEntry* logLineEntries, const uint16_t count)
 {
-    for (uint8_t i = 0; i < syslogSettingsCount; i++) {
-        Setting* setting = &settings[i];
-        if (setting->logId == logLineEntry.logId && (setting->logLevel != ELOG_LEVEL_NOLOG || logLineEntry.logLevel == ELOG_LEVEL_ALWAYS)) {
-            if (logLineEntry.logLevel <= setting->logLevel) {
-                setting->lastMsgLogLevel = logLineEntry.logLevel;
-                write(logLineEntry, *setting);
+    for (uint16_t n = 0; n < count; n++) {
+        const LogLineEntry& logLineEntry = logLineEntries[n];
+        for (uint8_t i = 0; i < syslogSettingsCount; i++) {
+            Setting* setting = &settings[i];
+            if (setting->logId == logLineEntry.logId && (setting->logLevel != ELOG_LEVEL_NOLOG || logLineEntry.logLevel == ELOG_LEVEL_ALWAYS)) {
+                if (logLineEntry.logLevel <= setting->logLevel) {
+                    setting->lastMsgLogLevel = logLineEntry.logLevel;
+                    write(logLineEntry, *setting);
+                }
+                handlePeek(logLineEntry, i); // If peek is enabled from query command
             }
-            handlePeek(logLineEntry, i); // If peek is enabled from query command
         }
     }
 }
@@ -181,8 +187,7 @@ void LogSyslog::handlePeek(const LogLineEntry logLineEntry, const uint8_t settin
     if (peekEnabled) {
         if (peekAllApps || settingIndex == peekSettingIndex) {
             if (logLineEntry.logLevel <= peekLoglevel) {
-                char logStamp[LENGTH_OF_LOG_STAMP];
-                formatter.getLogStamp(logStamp, logLineEntry.timestamp, logLineEntry.logLevel, settings[settingIndex].appName, 0);
+                const char* logStamp = formatter.getLogStampCached(logLineEntry, settings[settingIndex].stampPlan);
 
                 if (peekFilter) {
                     if (strcasestr(logLineEntry.logMessage, peekFilterText) != NULL) {
@@ -198,21 +203,18 @@ void LogSyslog::handlePeek(const LogLineEntry logLineEntry, const uint8_t settin
     }
 }
 
-/* Traverse all the registered syslogs and check if the logId and logLevel match the setting
- * logId: the log id
- * logLevel: the log level
+/* Add the log levels of all registrations to the table used by Elog::mustLog
+ * logLevelLimits: one entry per logId holding the highest log level that must be logged + 1. 0 means nothing
  */
-bool LogSyslog::mustLog(const uint8_t logId, const uint8_t logLevel)
+void LogSyslog::addLogLevelLimits(uint8_t* logLevelLimits)
 {
     for (uint8_t i = 0; i < syslogSettingsCount; i++) {
         Setting* setting = &settings[i];
-        if (setting->logId == logId) {
-            if (logLevel <= setting->logLevel && (setting->logLevel != ELOG_LEVEL_NOLOG || logLevel == ELOG_LEVEL_ALWAYS)) {
-                return true;
-            }
+        uint8_t limit = setting->logLevel == ELOG_LEVEL_NOLOG ? ELOG_LEVEL_ALWAYS + 1 : setting->logLevel + 1; // NOLOG still lets ALWAYS through
+        if (limit > logLevelLimits[setting->logId]) {
+            logLevelLimits[setting->logId] = limit;
         }
     }
-    return false;
 }
 
 /* Output the statistics for syslog
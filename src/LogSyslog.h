@@ -15,6 +15,7 @@ class LogSyslog {
         uint8_t facility;
         uint8_t logLevel;
         uint8_t lastMsgLogLevel;
+        LogStampPlan stampPlan; // For peek output
     };
 
     struct Stats {
@@ -30,9 +31,9 @@ public:
     uint8_t getLogLevel(const uint8_t logId, const uint8_t facility);
     void setLogLevel(const uint8_t logId, const uint8_t loglevel, const uint8_t facility);
     uint8_t getLastMsgLogLevel(const uint8_t logId, const uint8_t facility);
-    void outputFromBuffer(const LogLineEntry logLineEntry);
+    void outputFromBuffer(const LogLineEntry* logLineEntries, const uint16_t count);
     void handlePeek(const LogLineEntry logLineEntry, const uint8_t settingIndex);
-    bool mustLog(const uint8_t logId, const uint8_t logLevel);
+    void addLogLevelLimits(uint8_t* logLevelLimits);
     void outputStats();
     uint8_t registeredCount();
 
@@ -78,9 +79,9 @@ public:
     void begin() { }
     void configure(const char* serverName, const uint16_t port, const char* hostname, bool waitIfNotReady, const uint16_t maxWaitMilliseconds, const uint8_t maxRegistrations) { }
     void registerSyslog(const uint8_t logId, const uint8_t loglevel, const uint8_t facility, const char* appName) { }
-    void outputFromBuffer(const LogLineEntry logLineEntry) { }
+    void outputFromBuffer(const LogLineEntry* logLineEntries, const uint16_t count) { }
     void handlePeek(const LogLineEntry logLineEntry, const uint8_t settingIndex) { }
-    bool mustLog(const uint8_t logId, const uint8_t logLevel) { return false; }
+    void addLogLevelLimits(uint8_t* logLevelLimits) { }
     void outputStats() { }
     uint8_t registeredCount() { return 0; };
 